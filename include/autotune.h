@@ -0,0 +1,75 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include "allroot.h"
+#include "xmlConfig.h"
+#include "calib.h"
+#include <vector>
+#include <map>
+
+using namespace std;
+
+/*
+*	Search of the cut options for the best calibration of a dataset.
+*	Each entry of <tune> is an option followed by its candidate values, vectors as comma separated lists.
+*	The events are read into memory once, then every candidate runs the calibration on them in a
+*	forked process ( the children share the parent's memory ). A candidate is scored by its average
+*	single detector resolution and its TPC - VPD vertex width, both relative to the reference candidate.
+*	The search is over the full grid or by coordinate descent starting at the first value of each option.
+*/
+class autotune {
+public:
+
+	autotune( TChain * chain, uint nIterations, xmlConfig config );
+	~autotune();
+
+	// runs the search and writes the best config and the table of candidates
+	void run();
+
+protected:
+
+	struct candidate {
+		vector<int> choice;		// index of the value of each option
+		double resolution;		// average single detector resolution [ ns ]
+		double vzResolution;	// rms of TPC - VPD vertex [ cm ]
+		bool valid;
+	};
+
+	TChain * chain;
+	uint nIterations;
+	xmlConfig config;
+
+	// the options searched and their candidate values
+	vector<string> options;
+	vector< vector<string> > values;
+
+	// holds the in memory events and the first pass partials shared by the candidates
+	calib * sample;
+
+	// grid or descent
+	string method;
+	int nJobs;
+	int maxRounds;
+	double vzWeight;
+
+	map< vector<int>, candidate > scored;
+	// the first candidate that ran, empty until one did
+	vector<int> reference;
+
+	// scores the candidates that are not scored yet, nJobs at a time
+	void evaluate( const vector< vector<int> > &choices );
+	// runs one candidate, in the child process
+	void runCandidate( const vector<int> &choice, double * result );
+
+	xmlConfig candidateConfig( const vector<int> &choice );
+	string label( const vector<int> &choice );
+	double score( const vector<int> &choice );
+
+	void grid();
+	vector<int> descent();
+
+	void writeResults( const vector<int> &best );
+};
+
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef BLOCK_KERNELS_H
+#define BLOCK_KERNELS_H
+
+#include "eventStore.h"
+
+/*
+*	Kernels over one channel row ( eventBlock::width lanes ) of an event block.
+*	The loops have a fixed trip count and no branches so the compiler vectorizes them.
+*	On x86-64 with gcc each kernel is built for avx2 and for the baseline,
+*	the version matching the cpu is selected when the program starts.
+*/
+class blockKernels {
+public:
+
+	static const int width = eventBlock::width;
+
+	// the row kernels are instantiated for T = double and T = float
+
+	// out = in - off
+	template< typename T >
+	static void subtract( const T * in, T off, T * out );
+	// out = a - b
+	template< typename T >
+	static void subtractRows( const T * a, const T * b, T * out );
+
+	// bit l is set for lanes with !( x <= lo || x >= hi ), or !( x <= lo || x > hi ) for closedHigh
+	template< typename T >
+	static uint32_t rangeMask( const T * x, T lo, T hi, bool closedHigh );
+	// bit l is set for lanes with !( threshold > x )
+	template< typename T >
+	static uint32_t thresholdMask( const T * x, T threshold );
+
+	// TAxis::FindBin on the given edges ( nBins + 1 values ), edges must be increasing
+	// float edges must come from roundUp so that the bins are the same as for the double edges
+	template< typename T >
+	static void findBins( const T * x, const T * edges, int nBins, int * bins );
+	// scalar TAxis::FindBin, same result as the histogram for any edges
+	static int findBin( const double * edges, int nBins, double x );
+	static bool increasing( const double * edges, int nBins );
+	// each edge rounded to the nearest float not below it, for any float x
+	// e <= x holds exactly when roundUp( e ) <= x
+	static void roundUp( const double * edges, int n, float * out );
+
+	// out = table[ bin ], bins above maxIndex read table[ maxIndex ]
+	template< typename T >
+	static void gather( const T * table, const int * bins, int maxIndex, T * out );
+	// replaces out with alt in every lane where bins != keepBin
+	template< typename T >
+	static void select( const int * bins, int keepBin, const T * alt, T * out );
+
+	// sums[ l ] = sum of rows[ ch ][ l ] for first <= ch < last with bit ch of masks[ l ] set
+	// the channels are added in increasing order
+	template< typename T >
+	static void sideSums( const T ( * rows )[ width ], int first, int last, const uint64_t * masks, T * sums );
+};
+
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef BOOTSTRAP_SUMS_H
+#define BOOTSTRAP_SUMS_H
+
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+/*
+*	Poisson bootstrap of the binned means of one channel, filled in the same pass as the histograms.
+*	Every event gets a Poisson( 1 ) weight for each replica, hashed from its run and event number,
+*	so the replicas are the same on every pass over the same data and need no random state.
+*	Each replica keeps the weighted count and sum of every bin, the spread of the replica means
+*	is the statistical uncertainty of the bin mean.
+*/
+class bootstrapSums {
+public:
+
+	static const int maxReplicas = 64;
+
+	bootstrapSums() : nReplicas( 0 ), nBins( 0 ) {}
+
+	// sets the size and clears the sums
+	void configure( int nReplicas, int nBins );
+	void clear();
+	int replicas() const { return nReplicas; }
+
+	/**
+	 * The replica weights of an event, 0 to 8
+	 * @param run       the run of the event
+	 * @param evt       the event number
+	 * @param nReplicas number of weights
+	 * @param w         set to the weights
+	 * @return          the replicas with a non zero weight as a bit mask
+	 */
+	static uint64_t weights( int run, int evt, int nReplicas, uint8_t * w );
+
+	/**
+	 * Adds a value to a bin of every replica with a non zero weight
+	 * @param bin    the bin, 0 to nBins - 1
+	 * @param y      the value
+	 * @param w      the replica weights of the event
+	 * @param used   the mask returned by weights
+	 */
+	void fill( int bin, double y, const uint8_t * w, uint64_t used );
+
+	// mean of a bin in one replica, false if the replica has no entries in the bin
+	bool mean( int bin, int replica, double &m ) const;
+	// standard deviation of the replica means of a bin, 0 with fewer than two non empty replicas
+	double spread( int bin ) const;
+
+protected:
+
+	int nReplicas, nBins;
+	// [ bin * nReplicas + replica ]
+	vector<uint32_t> counts;
+	vector<double> sums;
+};
+
+
+#endif
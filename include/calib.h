@@ -7,6 +7,18 @@
 #include "constants.h"
 #include "TOFrPicoDst.h"
 #include "splineMaker.h"
+#include "pSpline.h"
+#include "sliceFitter.h"
+#include "resolutionFit.h"
+#include "sideStats.h"
+#include "vertexMatcher.h"
+#include "channelSet.h"
+#include "eventStore.h"
+#include "blockKernels.h"
+#include "globalSolver.h"
+#include "filePartial.h"
+#include "bootstrapSums.h"
+#include "crossValidator.h"
 #include <vector>
 #include <map>
 
@@ -36,8 +48,8 @@ private:
 	// the channel used as the reference for calculating offsets
 	uint refChannel;
 	// Dont use bad detectors
-	// defaults to false, set to true if dead channel is found
-	bool deadDetector[ constants::nChannels ];
+	// defaults to none, a channel is added if it is found dead
+	channelSet deadDetector;
 
 	// the initial offsets for each channel relative to the 1st channel on the west side
 	double tacOffsets[ constants::nChannels ];
@@ -60,6 +72,8 @@ private:
 
 	// the main chain object
 	TChain * _chain;
+	// the chain entries calibrated by this object, empty for all of them, see setEntries
+	vector<Long64_t> entryList;
 
 	// the histobook that stores all of our calibration histograms
 	histoBook *book;
@@ -75,15 +89,136 @@ private:
 	splineMaker * spline[ constants::nChannels ];
 	Interpolation::Type splineType;
 	bool useSpline;
+	// penalized B-spline fit instead of interpolating the bins ( splineType = pspline )
+	bool smoothSpline;
+	int splineSegments;
+	double splineSmoothing;
+	vector<double> splineCoefficients[ constants::nChannels ];
+	// bin weights of the last spline fit, kept for the checkpoint
+	vector<double> splineWeights[ constants::nChannels ];
+
+	// estimator used for the y slices of the slewing and avgN histograms
+	// see sliceFitter for the options
+	int sliceMethod;
+	// runs both FitSlicesY and the estimator and reports the per bin differences
+	bool validateSlices;
+
+	// use the leave one out median of each side as the reference time instead of the timing cut average
+	bool medianReference;
+
+	// fit of the single detector resolution in finish
+	// analytic ( closed form ), minuit ( TF1 fit ) or compare ( both, minuit result used )
+	string resolutionFitMethod;
+
+	// number of threads used for the per channel work between passes
+	int nThreads;
 
 
 	// list of detectors with prompt hits for this event and usable in calibration
 	// calculated for each event in outlierRejection()
-	bool useDetector[ constants::nChannels ];
+	channelSet useDetector;
 
 	bool westIsGood;
 	bool eastIsGood;
 
+	// the per pair outlier rejection histograms are filled for one in pairQAPrescale events
+	int pairQAPrescale;
+	long outlierEvents;
+
+	// events passing the event cuts are kept in memory for the calibration steps
+	bool inMemory;
+	eventStore store;
+	// the store read by the steps, another calibration's when shared, see shareEvents
+	const eventStore * activeStore;
+	// the block and lane of the current event when reading from the store, NULL when reading the chain
+	const eventBlock * activeBlock;
+	int activeBlockIndex;
+	int activeLane;
+
+	// single precision store, kernels and correction tables, see the precision option
+	bool floatCompute;
+	floatEventStore floatStore;
+	const floatEventStore * activeFloatStore;
+	// the current float block converted back, read by getX and getY
+	eventBlock floatBlockValues;
+	float * floatCorrection[ constants::nChannels ];
+	float * floatTotBins[ constants::nChannels ];
+	// per block results of the kernels, see prepareBlock
+	double blockCor[ constants::nChannels ][ eventBlock::width ];
+	double blockOutlierTime[ constants::nChannels ][ eventBlock::width ];
+	double blockSumWest[ eventBlock::width ], blockSumEast[ eventBlock::width ];
+	channelSet blockOutlierHits[ eventBlock::width ];
+
+	// solve for the corrections of each side by least squares instead of iterating, see directPass
+	bool directSolve;
+	double directRidge;
+	globalSolver directSides[ 2 ];
+
+	// early stopping of the iterations, see checkConvergence
+	bool stopOnConvergence;
+	int minIterations;
+	double convergeMaxChange, convergeRmsChange, convergeVzChange;
+	bool converged;
+	// set when the loop stops early
+	bool loopDone;
+	// average single detector resolution of finish
+	double finalResolution;
+	double lastVzResolution;
+
+	// wall clock budget for the whole job in seconds, 0 for none, see planBudget
+	double timeBudget;
+	double budgetReserve;
+	double jobStart;
+	// wall time of the last step and of its event loop, and the events it read
+	double stepSeconds, stepLoopSeconds;
+	long stepEventsRead;
+	// the event fraction of every step so far
+	vector<double> stepFractions;
+
+	// sidecar cache of the per file partials of binTOT and offsets, empty for none
+	string cacheDir;
+	int cacheSketchBins;
+	// the merged partials of all files
+	filePartial firstPass;
+	bool firstPassCached;
+	// binning of the tdcRaw histogram
+	static const int rawTdcBins = 1000;
+	static constexpr double rawTdcMax = 51200;
+	// y range of the tdctot histograms, the profile of which is the correction
+	static constexpr double tdcTotRange = 40;
+
+	// Poisson bootstrap of the corrections, 0 replicas for none
+	int bootstrapReplicas;
+	bootstrapSums bootstrap[ constants::nChannels ];
+	// standard deviation of the bootstrap corrections of each tot bin in the last step
+	vector<double> correctionSpread[ constants::nChannels ];
+
+	// held out scoring of the spline types and tot binnings, see crossValidate
+	crossValidator validator;
+	vector<string> cvSplineTypes;
+	vector<int> cvTOTBins;
+	double cvWindow;
+
+	// checkpoint written after every step, see writeCheckpoint
+	bool writeCheckpoints;
+	string checkpointName;
+	static const int checkpointVersion = 3;
+	// the step a resumed job started at and the tot bins usable in it
+	int resumeIteration;
+	bool resumeTotBinsReady[ constants::nChannels ];
+
+	// parameter file the corrections start from and the position in the cut schedules of the first step
+	string warmStartName;
+	int cutOffset;
+	// the steps of a job that starts from zero, restored when the warm start cannot be used
+	uint coldIterations;
+	bool coldStart();
+
+	// which channels have the totcor histogram of the previous iteration, see binForTOT
+	int totBinsIteration;
+	bool totBinsReady[ constants::nChannels ];
+	bool totBinsIncreasing[ constants::nChannels ];
+
 
 	// use for timing
 	clock_t startTime;
@@ -92,6 +227,11 @@ private:
 	xmlConfig config;
 
 	vector<double> avgNTimingCut;
+	// per step event fractions, see sampled
+	vector<double> eventFraction;
+	double stepFraction;
+	// chain entries of each run seen in the step, when the events are not in memory
+	map<int, long> sampleCounts;
 	vector<double> vzOutlierCut;
 	double avgNBackgroundCut;
 
@@ -115,7 +255,7 @@ private:
 	double TACToNS;
 
 	vector<int> maskedChannels;
-	map<int, bool> channelMask;
+	channelSet channelMask;
 	int firstRun, lastRun;
 
 	int minNTofHits;
@@ -148,11 +288,25 @@ public:
 
 	// executes the full correction loop
 	void loop();
+	// the loop one step at a time, for running several calibrations in lockstep
+	bool loopStep();
+	void finishLoop();
+
+	// points the chain's branches at this calibration's pico dst when several calibrations share the chain
+	void attachChain() { pico->Init( _chain ); }
+	// sharing the reads of the first passes and the in memory events between calibrations of the same data
+	void cacheFirstPass();
+	bool shareFirstPass( calib &other );
+	bool shareEvents( calib &other );
+	void loadEventStore();
 
 	// executes a single loop of the iterative correction process
 	void step( );
+	// accumulates and solves the least squares system for all corrections in one pass
+	void directPass( );
 	void checkStep( );
 	void prepareStepHistograms();
+	void prepareOutlierHistograms();
 
 	// after everything calculate the reference offset on channel 1 on the west
 	void referenceOffset();
@@ -162,9 +316,29 @@ public:
 	// get the bin for a given tot value ona given channel
 	int binForTOT( int vpdChannel, double tot );
 
+	// restricts every pass to the given chain entries in increasing order, used for the run groups
+	void setEntries( const vector<Long64_t> &entries ) { entryList = entries; }
+	// rms of the TPC - VPD vertex difference in the last step
+	double vertexResolution() const { return lastVzResolution; }
+	// average single detector resolution, set by finish
+	double averageResolution() const { return finalResolution; }
+	// mean statistical precision of the last corrections over the channels [ ns ]
+	double precision() { double worst = 0; return correctionPrecision( 1.0, worst ); }
+
 	void writeParameters(  );
+	void writeSpreads(  );
 	void writeTriggerParameters( );
 	void readParameters( );
+
+	// offsets of every channel through the data in run order, see the drift job type
+	void trackDrift( );
+
+	// starts the corrections from an earlier parameter file, see the warmStart option
+	bool warmStart( );
+
+	// the state between steps, for resuming a preempted job
+	void writeCheckpoint( );
+	bool readCheckpoint( );
 	
 	// reports
 	void stepReport();
@@ -184,6 +358,9 @@ public:
 
 protected:
 
+	// the index into the per step cut schedules ( vzOutlierCut, avgNTimingCut ) of the current step
+	uint cutLevel() const { return currentIteration + cutOffset; }
+
 	bool runInRange( int run ){
 		if ( 0 >= firstRun || 0 >= lastRun )
 			return true;
@@ -194,6 +371,45 @@ protected:
 	}
 
 	void makeCorrections();
+	// the correction pages of the report, see makeCorrections
+	void drawCorrection( int iteration, TH2D * post, splineMaker * vSpline );
+	void drawCorrections( int iteration );
+	// the last step whose correction pages are in the report
+	int drawnIteration;
+	bool checkConvergence( const vector<double> &previous );
+	void crossValidate();
+
+	// time budget planning and its summary page
+	bool planBudget();
+	double correctionPrecision( double scale, double &worst );
+	void budgetReport();
+	splineMaker * buildSpline( const double * edges, const double * contents, const double * weights, vector<double> &coefficients ) const;
+
+	// the chain entries of this calibration
+	Long64_t chainEntries() { return entryList.empty() ? _chain->GetEntries() : (Long64_t)entryList.size(); }
+	Long64_t chainEntry( Long64_t i ) const { return entryList.empty() ? i : entryList[ i ]; }
+
+	// event access for the calibration step, from the chain or from the in memory store
+	bool passEventCuts();
+	bool nextEvent( Int_t i, Int_t nevents );
+	bool sampled( long n );
+	template< typename T >
+	void loadEvents( basicEventStore< T > &events );
+	long storedEvents() const { return floatCompute ? activeFloatStore->size() : activeStore->size(); }
+	template< typename T >
+	void prepareBlock( const basicEventBlock< T > &b, const T * const * edges, const T * const * tables );
+	double eventCorrection( int vpdChannel );
+	void updateTotBins();
+
+	// per file partials of the first passes
+	void offsetBinning( int &nBins, double &lo, double &hi );
+	string inputKey();
+	string firstPassKey();
+	void fillFirstPass( Long64_t first, Long64_t last, filePartial &p, double tdcLo, double tdcHi );
+
+	// least squares corrections, see globalSolver
+	void addDirectHits( channelSet hits, const double * tot, const double * values );
+	void solveDirect();
 
 	// performs outlier rejection by selecting detectors on the east and west only when they produce
 	// a z vertex that is consistent with a prompt particle ( ie consistent with TPC vertex ).
@@ -201,6 +417,10 @@ protected:
 
 	void averageN();
 
+	// FitSlicesY or the built in estimator depending on the config
+	// results are left in gDirectory as <name>_1 and <name>_2 in both cases
+	void fitSlices( TH2D * h, TF1 * g, int cut = 0 );
+
 	void readTriggerToTofMap();
 
 	static Double_t detectorResolution(Double_t *x, Double_t *par);
@@ -0,0 +1,58 @@
+#ifndef CALIB_DAEMON_H
+#define CALIB_DAEMON_H
+
+#include "allroot.h"
+#include "xmlConfig.h"
+#include "calib.h"
+#include <string>
+
+using namespace std;
+
+/*
+*	Calibration server keeping a dataset in memory between jobs.
+*	The daemon reads the first pass and the events of its dataDir once, then listens on a Unix
+*	domain socket. A client ( jobType = submit ) sends the path of its config file and its working
+*	directory, the daemon runs the job of the config ( see <daemonJob> ) in a forked process that
+*	shares the resident data and replies with the paths of the parameter, root and report files.
+*/
+class calibDaemon {
+public:
+
+	calibDaemon( TChain * chain, uint nIterations, xmlConfig config );
+	~calibDaemon();
+
+	// serves jobs until a client asks it to stop
+	void serve();
+
+	// client side, sends the config file to the daemon and prints its reply, returns the exit code
+	static int submit( xmlConfig config, const char * configFile );
+
+protected:
+
+	TChain * chain;
+	uint nIterations;
+	xmlConfig config;
+
+	// holds the in memory events and the first pass partials shared by the jobs
+	calib * sample;
+
+	// seconds a client has to send its whole request
+	static const int requestTimeout = 10;
+
+	string socketPath;
+	int listenFd;
+	int nJobs;
+
+	bool listen();
+	// reads one request, true if it asks the daemon to stop
+	bool handle( int client, int &nRunning );
+	// runs one job in the child process and writes the reply to the client, false if it failed
+	bool runJob( int client, const string &dir, const string &configFile );
+	// waits for finished jobs, blocking until one ends when block is set
+	void reap( int &nRunning, bool block );
+
+	static bool reply( int client, const string &line );
+};
+
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef CALIB_VARIANTS_H
+#define CALIB_VARIANTS_H
+
+#include "allroot.h"
+#include "xmlConfig.h"
+#include "calib.h"
+#include <vector>
+
+using namespace std;
+
+/*
+*	Several calibrations of the same data with different options, run in lockstep.
+*	Each entry of <variants> is a list of option=value overrides of the job's config
+*	( vectors as comma separated lists ) and gets its own calib object and outputs.
+*	The first variant reads the first passes and the events, the others use its
+*	partials ( see calib::shareFirstPass ) and in memory events ( see calib::shareEvents )
+*	whenever they read the data the same way, so the data is read once for all variants.
+*/
+class calibVariants {
+public:
+
+	calibVariants( TChain * chain, uint nIterations, xmlConfig config );
+	~calibVariants();
+
+	// binTOT, offsets, the calibration loop and the parameter files of every variant
+	void calibrate();
+
+	int size() const { return (int)variants.size(); }
+
+protected:
+
+	xmlConfig config;
+	vector<calib*> variants;
+	vector<xmlConfig> configs;
+	vector<string> names;
+
+	// the config of one variant from its list of overrides
+	static xmlConfig variantConfig( xmlConfig config, string overrides, string defaultName );
+};
+
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef CHANNEL_SET_H
+#define CHANNEL_SET_H
+
+#include "constants.h"
+#include <stdint.h>
+
+/*
+*	A set of vpd channels stored as the bits of a 64 bit word.
+*	Bit i is channel i, the west side is the low nhChannels bits followed by the east side.
+*	Counting is a popcount and iterating visits only the channels in the set:
+*		for ( int j : live ) { ... }
+*/
+class channelSet {
+public:
+
+	channelSet() : bits( 0 ) {}
+	explicit channelSet( uint64_t b ) : bits( b & allBits() ) {}
+
+	// every channel / every channel on one side
+	static channelSet all() { return channelSet( allBits() ); }
+	static channelSet westChannels() { return channelSet( sideBits() << constants::startWest ); }
+	static channelSet eastChannels() { return channelSet( sideBits() << constants::startEast ); }
+
+	bool test( int i ) const { return ( bits >> i ) & 1; }
+	bool operator[]( int i ) const { return test( i ); }
+	void set( int i, bool value = true ) {
+		if ( value )
+			bits |= ( uint64_t )1 << i;
+		else
+			reset( i );
+	}
+	void reset( int i ) { bits &= ~( ( uint64_t )1 << i ); }
+	void clear() { bits = 0; }
+
+	int count() const { return __builtin_popcountll( bits ); }
+	bool any() const { return 0 != bits; }
+	bool none() const { return 0 == bits; }
+
+	// the channels of one side
+	channelSet west() const { return channelSet( bits & westChannels().bits ); }
+	channelSet east() const { return channelSet( bits & eastChannels().bits ); }
+	// the channels of one side with bit 0 as the first tube of that side, for the per side kernels
+	uint32_t westBits() const { return ( uint32_t )( ( bits >> constants::startWest ) & sideBits() ); }
+	uint32_t eastBits() const { return ( uint32_t )( ( bits >> constants::startEast ) & sideBits() ); }
+
+	channelSet operator&( const channelSet &o ) const { return channelSet( bits & o.bits ); }
+	channelSet operator|( const channelSet &o ) const { return channelSet( bits | o.bits ); }
+	channelSet operator~() const { return channelSet( ~bits ); }
+	channelSet &operator&=( const channelSet &o ) { bits &= o.bits; return *this; }
+	channelSet &operator|=( const channelSet &o ) { bits |= o.bits; return *this; }
+	bool operator==( const channelSet &o ) const { return bits == o.bits; }
+	bool operator!=( const channelSet &o ) const { return bits != o.bits; }
+
+	uint64_t raw() const { return bits; }
+
+	// visits the channels in increasing order
+	class iterator {
+	public:
+		iterator( uint64_t b ) : rest( b ) {}
+		int operator*() const { return __builtin_ctzll( rest ); }
+		iterator &operator++() { rest &= rest - 1; return *this; }
+		bool operator!=( const iterator &o ) const { return rest != o.rest; }
+	private:
+		uint64_t rest;
+	};
+	iterator begin() const { return iterator( bits ); }
+	iterator end() const { return iterator( 0 ); }
+
+private:
+
+	static uint64_t allBits() { return ( ( uint64_t )1 << constants::nChannels ) - 1; }
+	static uint64_t sideBits() { return ( ( uint64_t )1 << constants::nhChannels ) - 1; }
+
+	uint64_t bits;
+};
+
+#endif
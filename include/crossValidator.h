@@ -0,0 +1,82 @@
+#ifndef CROSS_VALIDATOR_H
+#define CROSS_VALIDATOR_H
+
+#include "constants.h"
+#include <vector>
+#include <string>
+
+using namespace std;
+
+/*
+*	Held out scoring of the correction options ( splineType and numTOTBins ) on the slewing curves.
+*	The events are split into folds by a hash of their run and event number, the first fold is held out
+*	of the calibration. Both folds are kept per channel in fine tot bins as sums of y and y^2, so that
+*	every candidate binning can be profiled from the training sums and every candidate correction
+*	scored on the validation sums in the same pass :
+*		width^2 = sum over fine bins of ( syy - 2 c sy + c^2 n ) / sum of n
+*	with c the candidate correction at the mean tot of the fine bin.
+*/
+class crossValidator {
+public:
+
+	struct candidate {
+		string splineType;	// none ( bin based ), linear, cspline, akima or pspline
+		int nBins;
+		// rms of the validation residuals of each channel, 0 for the channels not scored
+		vector<double> channelWidth;
+		// average over the scored channels
+		double width;
+		int nScored;
+	};
+
+	crossValidator() : nFolds( 0 ), nFine( 0 ), lo( 0 ), hi( 0 ) {}
+
+	// sets the folds and the fine tot binning, clears the sums
+	void configure( int nFolds, int nFine, double lo, double hi );
+	void clear();
+	bool enabled() const { return nFolds > 1; }
+
+	// true for the events of the validation fold
+	bool heldOut( int run, int evt ) const;
+
+	/**
+	 * Adds a hit to the training or validation sums of a channel
+	 * @param channel    the vpd channel
+	 * @param x          the tot value
+	 * @param y          the uncorrected time with respect to the reference, as in tdctot
+	 * @param validation true for the held out events
+	 */
+	void fill( int channel, double x, double y, bool validation );
+
+	/**
+	 * Profiles the training sums with each binning and scores each correction on the validation sums
+	 * @param splineTypes     candidate spline types
+	 * @param nBins           candidate numbers of tot bins
+	 * @param variableBinning equal training statistics per bin instead of equal widths
+	 * @param splineSegments  segments of the pspline
+	 * @param splineSmoothing penalty of the pspline
+	 * @return                one entry per combination
+	 */
+	vector<candidate> score( const vector<string> &splineTypes, const vector<int> &nBins, bool variableBinning,
+								int splineSegments, double splineSmoothing ) const;
+
+protected:
+
+	int nFolds;
+	int nFine;
+	double lo, hi;
+
+	// [ channel * nFine + fine bin ]
+	vector<double> trainN, trainY, trainYY;
+	vector<double> validN, validX, validY, validYY;
+
+	int fineBin( double x ) const;
+	// the candidate bin edges of a channel from its training sums
+	void edges( int channel, int nBins, bool variableBinning, vector<double> &e ) const;
+	// the validation width of one channel, negative when it cannot be scored
+	double channelScore( int channel, const string &splineType, int nBins, bool variableBinning,
+							int splineSegments, double splineSmoothing ) const;
+};
+
+
+#endif
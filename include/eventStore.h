@@ -0,0 +1,111 @@
+#ifndef EVENT_STORE_H
+#define EVENT_STORE_H
+
+#include "constants.h"
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+/*
+*	A fixed size block of events in array of structures of arrays layout.
+*	Each channel holds a row with one value per event so that the per channel
+*	work on a block ( offsets, range checks, correction lookup ) runs over contiguous lanes.
+*	T is the type of the channel values, double or float ( see the precision option )
+*/
+template< typename T >
+class basicEventBlock {
+public:
+
+	// events per block, 8 doubles fill one 512 bit or two 256 bit registers, 8 floats one 256 bit register
+	static const int width = 8;
+
+	basicEventBlock() : n( 0 ) {}
+
+	// number of events filled, lanes >= n hold copies of the last event
+	int n;
+
+	// getX and getY of every channel
+	T x[ constants::nChannels ][ width ];
+	T y[ constants::nChannels ][ width ];
+
+	// event level values
+	// the y values of the event are stored relative to yRef, a whole number of ns kept in double
+	// so that float blocks keep their precision for the large leading edge times, 0 in double blocks
+	double yRef[ width ];
+	double vertexZ[ width ];
+	int run[ width ];
+	int evt[ width ];
+	// position of the event among the chain entries of its run, cut or not, for the event sampling
+	long runEntry[ width ];
+
+	// copies the values of another block, converting the channel values
+	// the y values are made absolute again, so the copy should be a double block
+	template< typename U >
+	void assign( const basicEventBlock< U > &o ){
+		n = o.n;
+		for ( int ch = 0; ch < constants::nChannels; ch++ ){
+			for ( int l = 0; l < width; l++ ){
+				x[ ch ][ l ] = o.x[ ch ][ l ];
+				y[ ch ][ l ] = (double)o.y[ ch ][ l ] + o.yRef[ l ];
+			}
+		}
+		for ( int l = 0; l < width; l++ ){
+			yRef[ l ] = 0;
+			vertexZ[ l ] = o.vertexZ[ l ];
+			run[ l ] = o.run[ l ];
+			evt[ l ] = o.evt[ l ];
+			runEntry[ l ] = o.runEntry[ l ];
+		}
+	}
+};
+
+typedef basicEventBlock< double > eventBlock;
+typedef basicEventBlock< float > floatEventBlock;
+
+/*
+*	Events kept in memory after the first pass over the chain.
+*	Only events that pass the event level cuts of the calibration step are stored.
+*/
+template< typename T >
+class basicEventStore {
+public:
+
+	typedef basicEventBlock< T > block_type;
+
+	basicEventStore() : nEvents( 0 ) {}
+
+	void clear() { blocks.clear(); nEvents = 0; }
+
+	// starts a new event and returns the block and lane to fill
+	block_type & add( int &lane ){
+		if ( 0 == nEvents % block_type::width )
+			blocks.push_back( block_type() );
+		block_type &b = blocks.back();
+		lane = b.n++;
+		nEvents++;
+		return b;
+	}
+
+	// pads the unused lanes of the last block so that the kernels never see uninitialized values
+	void finish();
+
+	long size() const { return nEvents; }
+	bool empty() const { return 0 == nEvents; }
+	int nBlocks() const { return (int)blocks.size(); }
+	const block_type & block( int i ) const { return blocks[ i ]; }
+
+	// approximate memory use in MB
+	double megabytes() const { return blocks.size() * sizeof( block_type ) / ( 1024.0 * 1024.0 ); }
+
+protected:
+
+	vector< block_type > blocks;
+	long nEvents;
+};
+
+typedef basicEventStore< double > eventStore;
+typedef basicEventStore< float > floatEventStore;
+
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef FILE_PARTIAL_H
+#define FILE_PARTIAL_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <iosfwd>
+
+using namespace std;
+
+/*
+*	Partial results of the first passes ( binTOT and offsets ) over the events of one input file.
+*	The partials of several files are merged by adding them, so a rerun over a grown dataset
+*	only has to read the files that are not in the cache.
+*	Stored next to the data in a cache directory, one file per input file and configuration.
+*/
+class filePartial {
+public:
+
+	filePartial() : nChannels( 0 ), sketchBins( 0 ), offsetBins( 0 ), rawBins( 0 ), events( 0 ) {}
+
+	/**
+	 * Sets the size of the partial and zeroes it
+	 * @param nChannels  number of channels
+	 * @param sketchBins bins of the tot sketch of each channel
+	 * @param offsetBins y bins of the offset histogram
+	 * @param rawBins    y bins of the raw tdc histogram
+	 */
+	void setup( int nChannels, int sketchBins, int offsetBins, int rawBins );
+	void clear();
+
+	// adds the partial of another file with the same setup
+	bool add( const filePartial &other );
+
+	// fine histogram of the tot values of channel ch over [ lo, hi )
+	void fillSketch( int ch, double x, double lo, double hi );
+	long sketchCount( int ch ) const;
+	/**
+	 * The value with the given rank in the sorted tot values of a channel,
+	 * interpolated within the sketch bin that holds it
+	 */
+	double sketchValue( int ch, long rank, double lo, double hi ) const;
+
+	// the y bins of the histograms include the under and overflow bins, 0 and nBins + 1
+	double &offsetBin( int ch, int bin ) { return offset[ ch * ( offsetBins + 2 ) + bin ]; }
+	double &rawBin( int ch, int bin ) { return raw[ ch * ( rawBins + 2 ) + bin ]; }
+	double offsetContent( int ch, int bin ) const { return offset[ ch * ( offsetBins + 2 ) + bin ]; }
+	double rawContent( int ch, int bin ) const { return raw[ ch * ( rawBins + 2 ) + bin ]; }
+
+	// same bin as TAxis::FindFixBin
+	static int fixBin( double x, int nBins, double lo, double hi );
+
+	// text files with the non zero bins, written to a temporary file and renamed
+	bool read( string name );
+	bool write( string name ) const;
+
+	// 64 bit FNV-1a hash of a file's contents or of a string, as 16 hex digits
+	static string hashFile( string name );
+	static string hashString( string s );
+
+	int nChannels, sketchBins, offsetBins, rawBins;
+	long events;
+
+protected:
+
+	static const int version = 1;
+
+	vector<double> sketch;
+	vector<double> offset;
+	vector<double> raw;
+
+	static uint64_t fnv( const char * data, size_t n, uint64_t h );
+	static string hex( uint64_t h );
+	static void writeSparse( ostream &out, string key, const vector<double> &v );
+	static bool readSparse( istream &in, string key, vector<double> &v );
+};
+
+
+#endif
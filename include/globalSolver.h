@@ -0,0 +1,73 @@
+#ifndef GLOBAL_SOLVER_H
+#define GLOBAL_SOLVER_H
+
+#include <vector>
+
+using namespace std;
+
+/*
+*	Least squares solution for the slewing corrections of all channels on one side at once.
+*	Every event contributes sum_i ( v_i - c( i ) - < v - c > )^2 where v_i is the uncorrected
+*	time of hit i and c( i ) the correction of its channel and tot bin. The per event mean
+*	takes the place of the leave one out average of the iterative steps.
+*	The normal equations are accumulated over the events and solved by Cholesky decomposition.
+*/
+class globalSolver {
+public:
+
+	globalSolver() : nChannels( 0 ), nBins( 0 ), n( 0 ) { clear(); }
+
+	/**
+	 * Sets the size of the system, unknown channel * nBins + bin - 1 is the correction in bin
+	 * @param nChannels number of channels on the side
+	 * @param nBins     tot bins per channel, bins 1 .. nBins are solved for
+	 */
+	void setup( int nChannels, int nBins );
+	void clear();
+
+	/**
+	 * Adds the hits of one event, hits outside of bins 1 .. nBins are skipped
+	 * @param channels channel of each hit, 0 .. nChannels - 1
+	 * @param bins     tot bin of each hit
+	 * @param values   uncorrected time of each hit
+	 * @param nHits    number of hits
+	 */
+	void add( const int * channels, const int * bins, const double * values, int nHits );
+
+	/**
+	 * Solves the normal equations. A constant shift of all corrections does not change the
+	 * residuals, the ridge term ( relative to the mean diagonal ) makes the system positive definite
+	 * and the solution is then shifted so that its hit weighted mean is zero.
+	 * @param ridge relative ridge term
+	 * @param c     the corrections, nChannels * nBins values, bins without hits are 0
+	 * @return      false if nothing was added or the decomposition failed
+	 */
+	bool solve( double ridge, vector<double> &c ) const;
+
+	// sum of the squared residuals for the corrections c
+	double chi2( const vector<double> &c ) const;
+
+	long events() const { return nEvents; }
+	long hits() const { return nHits; }
+	// hits in unknown i
+	long hitCount( int i ) const { return count[ i ]; }
+
+	// in place Cholesky decomposition of the n x n matrix a ( row major ), the lower triangle holds L
+	static bool cholesky( double * a, int n );
+	// solves L L^T x = x in place
+	static void solveCholesky( const double * l, int n, double * x );
+
+protected:
+
+	int nChannels, nBins, n;
+
+	// normal matrix, right hand side and the number of hits of each unknown
+	vector<double> a, b;
+	vector<long> count;
+	// sum of ( v - < v > )^2, the chi2 without corrections
+	double sumSq;
+	long nEvents, nHits;
+};
+
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef ONLINE_CALIB_H
+#define ONLINE_CALIB_H
+
+#include "allroot.h"
+#include "xmlConfig.h"
+#include <set>
+#include <string>
+
+using namespace std;
+
+/*
+*	Calibration that follows a directory while the data is being taken.
+*	New files in dataDir are added to the chain as they are closed ( inotify, with a periodic scan for
+*	file systems without it ). Every onlineInterval seconds with at least onlineMinEvents new events the
+*	calibration is refreshed : the first passes come from the per file cache so only the new files are
+*	read, and after the first refresh the corrections warm start from the previous ones.
+*	Whenever the estimated precision of the corrections improves by onlinePrecisionGain the parameters
+*	and report are kept under a timestamp and a line is added to the summary.
+*/
+class onlineCalib {
+public:
+
+	onlineCalib( uint nIterations, xmlConfig config );
+	~onlineCalib();
+
+	// runs until the stop file exists or onlineMaxHours have passed
+	void run();
+
+protected:
+
+	TChain * chain;
+	uint nIterations;
+	xmlConfig config;
+
+	string dir;
+	string baseName;
+	// the files in the chain
+	set<string> files;
+
+	// inotify instance and watch, -1 when polling
+	int notifyFd, watchFd;
+
+	double interval;
+	long minEvents;
+	double settleSeconds;
+	double precisionGain;
+
+	Long64_t eventsAtRefresh;
+	double bestPrecision;
+	int nRefresh, nPublished;
+
+	void watch();
+	// adds a file to the chain unless it is there already, true if added
+	bool addFile( string name );
+	// adds the files that have not changed for settleSeconds, returns how many
+	int scan();
+	// waits up to seconds for closed files, returns how many were added
+	int wait( double seconds );
+	bool stopRequested( double start );
+
+	void refresh();
+	void publish( const string &stamp, double precision, double resolution, double vzResolution );
+
+	static string timestamp();
+	static bool copyFile( const string &from, const string &to );
+};
+
+
+#endif
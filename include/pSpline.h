@@ -0,0 +1,65 @@
+#ifndef P_SPLINE_H
+#define P_SPLINE_H
+
+#include <vector>
+
+using namespace std;
+
+class splineMaker;
+
+/*
+*	Penalized cubic B-spline ( P-spline ) on uniformly spaced knots.
+*	Fitted by weighted least squares to binned points with a penalty on the second
+*	differences of neighbouring coefficients, so noisy bins are smoothed instead of interpolated.
+*	The fit only needs the per bin means and weights, the system has nSegments + 3 unknowns.
+*	Does not touch ROOT objects so it can be used from worker threads.
+*/
+class pSpline {
+public:
+
+	/**
+	 * @param xmin      lower end of the domain
+	 * @param xmax      upper end of the domain
+	 * @param nSegments number of knot intervals
+	 * @param lambda    penalty strength relative to the mean data weight per coefficient
+	 */
+	pSpline( double xmin, double xmax, int nSegments, double lambda );
+
+	/**
+	 * Fits the coefficients, points with weight <= 0 or outside of the domain are skipped
+	 * @param x points
+	 * @param y values
+	 * @param w weights, 1 / error^2 or the number of entries
+	 * @param n number of points
+	 * @return  false if there are no points or the system cannot be solved
+	 */
+	bool fit( const double * x, const double * y, const double * w, int n );
+
+	// value at x, clamped to the domain
+	double eval( double x ) const;
+
+	// a splineMaker with the same curve in piecewise cubic form, NULL before a successful fit
+	splineMaker * makeSpline() const;
+
+	const vector< double > &coefficients() const { return coef; }
+	double minimum() const { return xmin; }
+	double maximum() const { return xmax; }
+	int segments() const { return nSegments; }
+
+	// the four non zero cubic B-spline basis values at t in [ 0, 1 ] of a segment
+	static void basis( double t, double * b );
+
+protected:
+
+	double xmin, xmax, h;
+	int nSegments;
+	double lambda;
+	bool fitted;
+	vector< double > coef;
+
+	// segment and position within it
+	int locate( double x, double &t ) const;
+};
+
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef RESOLUTION_FIT_H
+#define RESOLUTION_FIT_H
+
+#include <cmath>
+
+/*
+*	Weighted least squares fit of the single detector resolution model
+*		sigma( N ) = p0 / sqrt( N / ( 1 + N ) )
+*	( see calib::detectorResolution ).
+*	The model is linear in p0 so the chi2 minimum is found in closed form from three sums.
+*	Header only so that the macros in script/ can include it directly.
+*/
+class resolutionFit {
+public:
+
+	resolutionFit() { clear(); }
+
+	void clear() {
+		sumWff = 0;
+		sumWfy = 0;
+		sumWyy = 0;
+		n = 0;
+	}
+
+	// the model for p0 = 1
+	static double shape( double N ) {
+		if ( N <= 0 )
+			return 0;
+		return 1.0 / sqrt( N / ( 1.0 + N ) );
+	}
+
+	/**
+	 * Adds a measured point. Like a chi2 fit to a histogram, points without
+	 * a positive error are skipped.
+	 * @param N     the number of detectors in the average
+	 * @param sigma the measured width
+	 * @param error the error on the measured width
+	 */
+	void add( double N, double sigma, double error ) {
+		if ( error <= 0 || N <= 0 )
+			return;
+		double f = shape( N );
+		double w = 1.0 / ( error * error );
+		sumWff += w * f * f;
+		sumWfy += w * f * sigma;
+		sumWyy += w * sigma * sigma;
+		n++;
+	}
+
+	// the single detector resolution
+	double parameter() const {
+		if ( sumWff <= 0 )
+			return 0;
+		return sumWfy / sumWff;
+	}
+
+	double parameterError() const {
+		if ( sumWff <= 0 )
+			return 0;
+		return 1.0 / sqrt( sumWff );
+	}
+
+	double chi2() const {
+		if ( sumWff <= 0 )
+			return 0;
+		double c = sumWyy - sumWfy * sumWfy / sumWff;
+		return c > 0 ? c : 0;
+	}
+
+	int nPoints() const { return n; }
+	int ndf() const { return n - 1; }
+
+	double chi2PerNdf() const {
+		if ( ndf() < 1 )
+			return 0;
+		return chi2() / (double)ndf();
+	}
+
+private:
+	double sumWff, sumWfy, sumWyy;
+	int n;
+};
+
+#endif
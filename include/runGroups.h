@@ -0,0 +1,71 @@
+#ifndef RUN_GROUPS_H
+#define RUN_GROUPS_H
+
+#include "allroot.h"
+#include "xmlConfig.h"
+#include <vector>
+#include <map>
+
+using namespace std;
+
+/*
+*	Run by run calibration in one job.
+*	The events of the chain are split into groups of consecutive runs and each group is calibrated
+*	on its own entries only, so all groups together read the data about as often as one calibration.
+*	Every run is a group unless the first run of each group is given in runGroupStarts.
+*	Groups with fewer than minGroupEvents events are merged with the following group
+*	( the last one with the previous ).
+*/
+class runGroups {
+public:
+
+	struct group {
+		int firstRun, lastRun, nRuns;
+		long events;
+		// [ first, last ) chain entry ranges of the runs in the group
+		vector< pair< Long64_t, Long64_t > > ranges;
+		// results of the calibration
+		string baseName;
+		double vzResolution;
+	};
+
+	runGroups( TChain * chain, xmlConfig config );
+
+	// reads the run of every chain entry, only the run branch is read
+	void scan();
+
+	/**
+	 * Builds the groups from the scanned runs
+	 * @param starts    first run of each group, every run is a group if empty
+	 * @param minEvents groups with fewer events are merged with a neighbour
+	 */
+	void makeGroups( const vector<int> &starts, long minEvents );
+
+	/**
+	 * Runs the calibrate job for every group with the config of this job, writing
+	 * the parameters, root file and report of each group with the group's baseName.
+	 * Ends with a summary of the groups in <baseName><runGroupsOutput>
+	 */
+	void calibrate( uint nIterations );
+
+	const vector<group> &list() const { return groups; }
+	// the entry ranges of every scanned run, in run order
+	const map< int, vector< pair< Long64_t, Long64_t > > > &runs() const { return runEntries; }
+
+protected:
+
+	TChain * chain;
+	xmlConfig config;
+
+	// entry ranges and number of events of each run
+	map< int, vector< pair< Long64_t, Long64_t > > > runEntries;
+	map< int, long > runEvents;
+
+	vector<group> groups;
+
+	void merge( group &into, const group &g );
+	void writeSummary();
+};
+
+
+#endif
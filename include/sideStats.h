@@ -0,0 +1,66 @@
+#ifndef SIDE_STATS_H
+#define SIDE_STATS_H
+
+#include "constants.h"
+#include <stdint.h>
+#include <vector>
+#include <utility>
+
+using namespace std;
+
+/*
+*	Robust statistics of the times on one side of the vpd for a single event.
+*	The tubes are sorted once with a fixed size sorting network, after that the
+*	plain mean, the timing cut mean and the median leaving out any one tube
+*	are found without looping over the other tubes again.
+*/
+class sideStats {
+public:
+
+	static const int size = constants::nhChannels;
+
+	/**
+	 * Loads the times of one side
+	 * @param values times of the tubes on this side, entries not selected by a mask are never read
+	 * @param inMean bit mask of the tubes used in the plain mean ( see channelSet::westBits )
+	 * @param inCut  bit mask of the tubes that may pass the timing cut, also used for the median
+	 */
+	void set( const double * values, uint32_t inMean, uint32_t inCut );
+
+	/**
+	 * Each of these returns the number of tubes used and sets the statistic.
+	 * leaveOut is the index on this side of a tube to exclude, -1 for none.
+	 * An empty selection gives NaN, the same as dividing the empty sums directly.
+	 */
+	int mean( int leaveOut, double &mean ) const;
+	// mean of the cut tubes with center - cut < t < center + cut ( same comparisons as the two pass loops )
+	int cutMean( int leaveOut, double center, double cut, double &mean ) const;
+	int median( int leaveOut, double &median ) const;
+
+	// compare exchange pairs of the sorting network for size elements
+	static const vector< pair< int, int > > &network();
+
+protected:
+
+	const double * v;
+	uint32_t mMask;
+	uint32_t cMask;
+
+	static bool has( uint32_t mask, int i ) { return ( mask >> i ) & 1; }
+
+	// plain mean
+	double sum;
+	int n;
+
+	// sorted cut candidates and their prefix sums
+	double sorted[ size ];
+	double prefix[ size + 1 ];
+	int nSorted;
+
+	// first index where the exact cut comparison passes / fails
+	int lowerIndex( double center, double cut ) const;
+	int upperIndex( double center, double cut ) const;
+};
+
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef SLICE_FITTER_H
+#define SLICE_FITTER_H
+
+#include "allroot.h"
+
+using namespace std;
+
+/*
+*	Gaussian estimators for the y slices of a 2D histogram.
+*	Used in place of TH2::FitSlicesY when a full Minuit fit per slice is not needed.
+*/
+class sliceFitter {
+public:
+
+	// estimator types
+	static const int root = 0;			// TH2::FitSlicesY with the given TF1
+	static const int truncated = 1;		// iterated truncated mean / rms with truncation correction
+	static const int logParabola = 2;	// weighted parabola fit to log( counts ) around the peak
+
+	// bin contents of a 2D histogram, copied so that the estimation does not touch ROOT
+	struct sliceInput {
+		int nx, ny;
+		vector<double> centers;		// y bin centers
+		vector<double> counts;		// nx * ny, slice ix starts at ( ix - 1 ) * ny
+	};
+
+	// estimates for every x bin
+	struct sliceResult {
+		vector<double> mean, meanError, sigma, sigmaError;
+		vector<bool> valid;
+	};
+
+	static int methodFromString( string name );
+	static string methodName( int method );
+
+	/**
+	 * Estimates the gaussian mean and sigma of a single binned slice
+	 * Does not touch any ROOT objects so it is safe to call from worker threads
+	 * @param  method  truncated or logParabola
+	 * @param  centers bin centers
+	 * @param  counts  bin contents
+	 * @param  n       number of bins
+	 * @param  lo, hi  the range considered ( the range of the fit function )
+	 * @return         false if the slice could not be estimated
+	 */
+	static bool estimate( 	int method, const double * centers, const double * counts, int n,
+							double lo, double hi,
+							double &mean, double &meanError, double &sigma, double &sigmaError );
+
+	/**
+	 * Mirrors TH2::FitSlicesY : creates <name>_1 ( mean ) and <name>_2 ( sigma ) in gDirectory
+	 * @param h    the 2D histogram
+	 * @param lo   low edge of the estimation range
+	 * @param hi   high edge of the estimation range
+	 * @param cut  slices with fewer entries are skipped
+	 * @param name prefix of the output histograms, defaults to the name of h
+	 */
+	static void fitSlicesY( TH2 * h, int method, double lo, double hi, int cut = 0, string name = "" );
+
+	// the three stages of fitSlicesY, only snapshot and makeHistograms need the main thread
+	static void snapshot( TH2 * h, sliceInput &in );
+	static void estimateSlices( int method, const sliceInput &in, double lo, double hi, int cut, sliceResult &out );
+	static void makeHistograms( TH2 * h, const sliceResult &res, string name = "" );
+
+	// number of sigma kept in the truncated window
+	static const double windowSigma;
+	// maximum number of refinement iterations
+	static const int maxIterations = 10;
+
+protected:
+
+	static bool truncatedMean( 	const double * centers, const double * counts, int n, double binWidth,
+								double lo, double hi,
+								double &mean, double &sigma, double &nInWindow );
+	static bool logParabolaFit( const double * centers, const double * counts, int n,
+								double lo, double hi,
+								double &mean, double &sigma, double &nInWindow );
+
+};
+
+
+#endif
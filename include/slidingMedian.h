@@ -0,0 +1,35 @@
+#ifndef SLIDING_MEDIAN_H
+#define SLIDING_MEDIAN_H
+
+#include <set>
+
+using namespace std;
+
+/*
+*	Median of a window of values that changes one value at a time.
+*	The values are split into a lower and an upper half, each kept sorted, so adding or
+*	removing a value costs O( log n ) and the median is read from the ends of the halves.
+*/
+class slidingMedian {
+public:
+
+	void add( double v );
+	// removes one copy of a value that was added, false if it is not in the window
+	bool remove( double v );
+	void clear() { low.clear(); high.clear(); }
+
+	long size() const { return (long)( low.size() + high.size() ); }
+	bool empty() const { return low.empty(); }
+	// the median, the mean of the two middle values for an even size, 0 when empty
+	double median() const;
+
+protected:
+
+	// low holds the smaller half and has as many values as high or one more
+	multiset<double> low, high;
+
+	void balance();
+};
+
+
+#endif
@@ -24,12 +24,34 @@ public:
 	// from histogram
 	splineMaker( TH1D* hist, int place = splineAlignment::left, Interpolation::Type type = Interpolation::kCSPLINE, int firstBin = 1, int lastBin = -1 );
 
+	// from the piecewise cubic coefficients of each segment ( see pSpline ), there is no interpolator
+	splineMaker( 	const vector< double > &knots, const vector< double > &c0, const vector< double > &c1,
+					const vector< double > &c2, const vector< double > &c3 );
+
+	// builds the knots used by the histogram constructor from bin edges ( nBins + 1 ) and contents ( nBins )
+	// does not touch ROOT objects so it can be used from worker threads
+	static void knotsFromBins( 	const double * edges, const double * contents, int nBins, int place,
+								vector< double > &x, vector< double > &y, int firstBin = 1, int lastBin = -1 );
+
 	TGraph* graph( double xmin, double xmax, double step );
 	//void draw( TH1D* hist, double xmin, double xmax, double step );
 
-	double eval( double x );
+	double eval( double x ) const;
+
+	/**
+	 * Evaluates the spline for every value in x, clamped to the domain like eval( x )
+	 * Only reads the precomputed segment coefficients so it is safe to call from worker threads
+	 * @param x input values
+	 * @param y output values, may not alias x
+	 * @param n number of values
+	 */
+	void eval( const double * x, double * y, int n ) const;
+	// evaluates on the uniform grid xmin + i * step for i < n, walks the segments instead of searching
+	void evalGrid( double xmin, double step, int n, double * y ) const;
 
 	Interpolator* getSpline() { return spline; }
+	// true if the spline can be evaluated
+	bool ready() const { return spline || piecewise; }
 
 	~splineMaker();
 
@@ -40,6 +62,14 @@ public:
 private:
 	Interpolator* spline;
 	double domainMin, domainMax;
+
+	// piecewise cubic coefficients of every segment, y = c0 + c1 t + c2 t^2 + c3 t^3 with t = x - knots[ i ]
+	// stored contiguously per power so that the batch evaluation vectorizes
+	void tabulate( Interpolation::Type type );
+	int segment( double x ) const;
+	bool piecewise;		// false for interpolation types that are not piecewise cubic ( polynomial )
+	vector< double > knots;
+	vector< double > c0, c1, c2, c3;
 };
 
 
@@ -2,6 +2,8 @@
 #define UTILS_H
 
 #include <string>
+#include <functional>
+#include <stdint.h>
 
 using namespace std;
 
@@ -12,6 +14,17 @@ namespace jdbUtils{
 	std::string ts( double );
 	std::string ts( unsigned int );
 	void progressBar( int i, int nevents, int max );
+
+	// wall clock seconds from a fixed point, for the time budget ( clock() counts cpu time of all threads )
+	double wallTime();
+
+	// deterministic 64 bit hash of an event, different for each stream ( splitmix64 )
+	// used to give events reproducible random weights and folds without random state
+	uint64_t eventHash( int run, int evt, uint64_t stream );
+
+	// calls f( i ) for i = 0 .. n-1 spread over nThreads threads
+	// f must not create, fill or draw ROOT objects
+	void parallelFor( int n, int nThreads, std::function<void(int)> f );
 }
 
 
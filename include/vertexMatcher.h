@@ -0,0 +1,46 @@
+#ifndef VERTEX_MATCHER_H
+#define VERTEX_MATCHER_H
+
+#include "constants.h"
+#include <stdint.h>
+
+/*
+*	Finds the west x east tube pairs whose vpd vertex is within a cut of the TPC vertex.
+*	For a fixed west time the implied vertex is monotonic in the east time, so the matching
+*	east tubes form a contiguous window in the sorted east times. The window only moves
+*	forward as the west time increases, so all pairs are found with two pointers.
+*/
+class vertexMatcher {
+public:
+
+	static const int size = constants::nhChannels;
+
+	/**
+	 * Matches the tubes of one event. Uses the same comparison as
+	 * TMath::Abs( tpcZ - vpdZ ) < vzCut with vpdZ = c * ( east - west ) / 2
+	 * @param west      corrected west times
+	 * @param nWest     number of west times ( <= size )
+	 * @param east      corrected east times
+	 * @param nEast     number of east times ( <= size )
+	 * @param tpcZ      the TPC vertex
+	 * @param vzCut     the cut on | tpcZ - vpdZ |
+	 * @param flip      vpdZ = c * ( west - east ) / 2 instead ( trigger times )
+	 * @param westMatch bit i is set if west time i is in at least one valid pair
+	 * @param eastMatch bit i is set if east time i is in at least one valid pair
+	 * @return          the number of valid pairs
+	 */
+	static int match( 	const double * west, int nWest, const double * east, int nEast,
+						double tpcZ, double vzCut, bool flip,
+						uint32_t &westMatch, uint32_t &eastMatch );
+
+	// the vertex of a single pair
+	static double vertex( double west, double east, bool flip ){
+		if ( flip )
+			return constants::c * ( west - east ) / 2.0;
+		return constants::c * ( east - west ) / 2.0;
+	}
+
+};
+
+
+#endif
@@ -10,6 +10,7 @@
 #include <sstream>
 #include <algorithm>
 #include <vector>
+#include <map>
 
 
 using namespace std;
@@ -39,10 +40,22 @@ public:
 	bool nodeExists( char* nName );
 	bool isVector( char* nName );
 
+	// replaces the value of a node, for configs derived from this one
+	// vectors are given as a comma separated list
+	void set( char* nName, string value );
+	// writes the config file with the set values in place of the file's
+	bool write( string filename );
+
 private:
 	string configFile;
 	string fname;
 
+	// values set in the program, they take precedence over the file
+	map<string, string> overrides;
+
+	// finds the node nName under the root node, as the getters do, skipping comments and nested nodes
+	static bool findNode( const string &xml, const string &nName, size_t &nodeStart, size_t &nodeEnd, size_t &rootEnd );
+
 
 
 };
@@ -0,0 +1,319 @@
+
+#include "autotune.h"
+#include "utils.h"
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <algorithm>
+#include <thread>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// provides my own string shortcuts etc.
+using namespace jdbUtils;
+
+autotune::autotune( TChain * chain, uint nIterations, xmlConfig config ){
+
+	this->chain = chain;
+	this->nIterations = nIterations;
+
+	// the candidates only share the events when they are in memory
+	config.set( "inMemory", "true" );
+	this->config = config;
+
+	method = config.getAsString( "tuneMethod", "descent" );
+	nJobs = config.getAsInt( "tuneJobs", config.getAsInt( "nThreads", 1 ) );
+	if ( nJobs <= 0 )
+		nJobs = std::thread::hardware_concurrency();
+	if ( nJobs < 1 )
+		nJobs = 1;
+	maxRounds = config.getAsInt( "tuneRounds", 3 );
+	vzWeight = config.getAsDouble( "tuneVzWeight", 1.0 );
+
+	// option value value ...
+	vector<string> list = config.getAsStringVector( "tune" );
+	for ( unsigned int i = 0; i < list.size(); i++ ){
+		stringstream sstr( list[ i ] );
+		string option, value;
+		vector<string> v;
+		sstr >> option;
+		while ( sstr >> value )
+			v.push_back( value );
+		if ( "" == option || v.empty() ) continue;
+
+		options.push_back( option );
+		values.push_back( v );
+		cout << "[autotune." << __FUNCTION__ << "] " << option << " : " << v.size() << " values" << endl;
+	}
+
+	xmlConfig sConfig = config;
+	sConfig.set( "baseName", config.getAsString( "baseName" ) + "tuneSample_" );
+	sample = new calib( chain, nIterations, sConfig );
+}
+
+autotune::~autotune(){
+	delete sample;
+}
+
+xmlConfig autotune::candidateConfig( const vector<int> &choice ){
+	xmlConfig c = config;
+	for ( unsigned int i = 0; i < options.size(); i++ )
+		c.set( (char*)options[ i ].c_str(), values[ i ][ choice[ i ] ] );
+	return c;
+}
+
+string autotune::label( const vector<int> &choice ){
+	string l = "";
+	for ( unsigned int i = 0; i < choice.size(); i++ )
+		l += ( i > 0 ? "_" : "" ) + ts( choice[ i ] );
+	return l;
+}
+
+/**
+ * Resolution and vertex width relative to the reference candidate, lower is better
+ */
+double autotune::score( const vector<int> &choice ){
+
+	map< vector<int>, candidate >::iterator it = scored.find( choice );
+	map< vector<int>, candidate >::iterator itRef = scored.find( reference );
+	if ( scored.end() == it || scored.end() == itRef || !it->second.valid || !itRef->second.valid )
+		return 1e9;
+
+	const candidate &c = it->second;
+	const candidate &ref = itRef->second;
+	return ( c.resolution / ref.resolution + vzWeight * c.vzResolution / ref.vzResolution ) / ( 1.0 + vzWeight );
+}
+
+void autotune::runCandidate( const vector<int> &choice, double * result ){
+
+	xmlConfig c = candidateConfig( choice );
+	c.set( "baseName", config.getAsString( "baseName" ) + "tune" + label( choice ) + "_" );
+
+	calib candidateCalib( chain, nIterations, c );
+	candidateCalib.attachChain();
+	if ( !candidateCalib.shareFirstPass( *sample ) )
+		cout << "[autotune." << __FUNCTION__ << "] reading the first pass" << endl;
+	if ( !candidateCalib.shareEvents( *sample ) )
+		cout << "[autotune." << __FUNCTION__ << "] reading the events" << endl;
+
+	candidateCalib.binTOT( c.getAsBool( "variableBinning" ) );
+	candidateCalib.offsets();
+	candidateCalib.warmStart();
+	candidateCalib.loop();
+
+	result[ 0 ] = candidateCalib.averageResolution();
+	result[ 1 ] = candidateCalib.vertexResolution();
+}
+
+void autotune::evaluate( const vector< vector<int> > &choices ){
+
+	vector< vector<int> > todo;
+	for ( unsigned int i = 0; i < choices.size(); i++ ){
+		if ( scored.count( choices[ i ] ) || find( todo.begin(), todo.end(), choices[ i ] ) != todo.end() ) continue;
+		todo.push_back( choices[ i ] );
+	}
+
+	// pid -> read end of the pipe and the candidate
+	map< pid_t, pair< int, vector<int> > > running;
+	unsigned int next = 0;
+	while ( next < todo.size() || !running.empty() ){
+
+		while ( next < todo.size() && (int)running.size() < nJobs ){
+			const vector<int> &choice = todo[ next++ ];
+			cout << "[autotune." << __FUNCTION__ << "] Candidate " << label( choice ) << endl;
+
+			int fd[ 2 ] = { -1, -1 };
+			pid_t pid = -1;
+			cout.flush();
+			fflush( stdout );
+			if ( 0 == pipe( fd ) )
+				pid = fork();
+
+			if ( 0 == pid ){
+				// the child logs to its own file and reports through the pipe
+				close( fd[ 0 ] );
+				string log = config.getAsString( "baseName" ) + "tune" + label( choice ) + ".log";
+				if ( !freopen( log.c_str(), "w", stdout ) )
+					cout.setstate( ios::failbit );
+				double result[ 2 ] = { 0, 0 };
+				runCandidate( choice, result );
+				cout.flush();
+				fflush( stdout );
+				ssize_t n = ::write( fd[ 1 ], result, sizeof( result ) );
+				close( fd[ 1 ] );
+				_exit( n == sizeof( result ) ? 0 : 1 );
+			}
+
+			if ( pid < 0 ){
+				// the pipe is not needed when the fork failed
+				if ( fd[ 0 ] >= 0 ){
+					close( fd[ 0 ] );
+					close( fd[ 1 ] );
+				}
+				// no process, run it here
+				cout << "[autotune." << __FUNCTION__ << "] Cannot fork, running the candidate in this process" << endl;
+				double result[ 2 ] = { 0, 0 };
+				runCandidate( choice, result );
+				candidate &c = scored[ choice ];
+				c.choice = choice;
+				c.resolution = result[ 0 ];
+				c.vzResolution = result[ 1 ];
+				c.valid = result[ 0 ] > 0 && result[ 1 ] > 0;
+				continue;
+			}
+
+			close( fd[ 1 ] );
+			running[ pid ] = make_pair( fd[ 0 ], choice );
+		}
+
+		if ( running.empty() )
+			continue;
+
+		int status = 0;
+		pid_t pid = waitpid( -1, &status, 0 );
+		if ( pid < 0 || !running.count( pid ) )
+			continue;
+
+		double result[ 2 ] = { 0, 0 };
+		int fd = running[ pid ].first;
+		ssize_t n = ::read( fd, result, sizeof( result ) );
+		close( fd );
+
+		candidate &c = scored[ running[ pid ].second ];
+		c.choice = running[ pid ].second;
+		c.resolution = result[ 0 ];
+		c.vzResolution = result[ 1 ];
+		c.valid = n == sizeof( result ) && WIFEXITED( status ) && 0 == WEXITSTATUS( status ) && result[ 0 ] > 0 && result[ 1 ] > 0;
+
+		cout << "[autotune." << __FUNCTION__ << "] Candidate " << label( c.choice ) << " : " << ( c.valid ? "" : "failed, " )
+			<< "resolution " << c.resolution << " ns, vz width " << c.vzResolution << " cm" << endl;
+		running.erase( pid );
+	}
+
+	// the first valid one in the order asked for, not in the order the jobs ended
+	for ( unsigned int i = 0; i < todo.size() && reference.empty(); i++ ){
+		if ( scored[ todo[ i ] ].valid ){
+			reference = todo[ i ];
+			if ( reference != vector<int>( options.size(), 0 ) )
+				cout << "[autotune." << __FUNCTION__ << "] The first candidate failed, scoring relative to " << label( reference ) << endl;
+		}
+	}
+}
+
+void autotune::grid(){
+
+	vector< vector<int> > all;
+	vector<int> choice( options.size(), 0 );
+	while ( true ){
+		all.push_back( choice );
+		// next combination
+		unsigned int i = 0;
+		for ( ; i < choice.size(); i++ ){
+			if ( ++choice[ i ] < (int)values[ i ].size() )
+				break;
+			choice[ i ] = 0;
+		}
+		if ( i == choice.size() )
+			break;
+	}
+
+	cout << "[autotune." << __FUNCTION__ << "] " << all.size() << " candidates" << endl;
+	evaluate( all );
+}
+
+vector<int> autotune::descent(){
+
+	vector<int> best( options.size(), 0 );
+	evaluate( vector< vector<int> >( 1, best ) );
+
+	for ( int round = 0; round < maxRounds; round++ ){
+		bool improved = false;
+
+		// every value of one option with the others at their best, all of them at once
+		for ( unsigned int i = 0; i < options.size(); i++ ){
+			vector< vector<int> > line;
+			for ( unsigned int k = 0; k < values[ i ].size(); k++ ){
+				vector<int> c = best;
+				c[ i ] = k;
+				line.push_back( c );
+			}
+			evaluate( line );
+
+			for ( unsigned int k = 0; k < line.size(); k++ ){
+				if ( score( line[ k ] ) < score( best ) ){
+					best = line[ k ];
+					improved = true;
+				}
+			}
+			cout << "[autotune." << __FUNCTION__ << "] Round " << round << ", " << options[ i ] << " = " << values[ i ][ best[ i ] ] << " ( score " << score( best ) << " )" << endl;
+		}
+
+		if ( !improved )
+			break;
+	}
+	return best;
+}
+
+void autotune::run(){
+
+	if ( options.empty() ){
+		cout << "[autotune." << __FUNCTION__ << "] Nothing to tune" << endl;
+		return;
+	}
+
+	// the data is read once, the children get a copy of the memory
+	sample->attachChain();
+	sample->cacheFirstPass();
+	sample->loadEventStore();
+
+	vector<int> best( options.size(), 0 );
+	if ( "grid" == method ){
+		grid();
+		for ( map< vector<int>, candidate >::iterator it = scored.begin(); it != scored.end(); ++it ){
+			if ( score( it->first ) < score( best ) )
+				best = it->first;
+		}
+	} else
+		best = descent();
+
+	writeResults( best );
+}
+
+void autotune::writeResults( const vector<int> &best ){
+
+	string baseName = config.getAsString( "baseName" );
+
+	// every candidate
+	string tName = baseName + config.getAsString( "tuneTableOutput", "autotune.dat" );
+	ofstream f( tName.c_str() );
+	f << "# score resolution[ns] vzWidth[cm]";
+	for ( unsigned int i = 0; i < options.size(); i++ )
+		f << " " << options[ i ];
+	f << endl;
+	for ( map< vector<int>, candidate >::iterator it = scored.begin(); it != scored.end(); ++it ){
+		f << score( it->first ) << " " << it->second.resolution << " " << it->second.vzResolution;
+		for ( unsigned int i = 0; i < options.size(); i++ )
+			f << " " << values[ i ][ it->first[ i ] ];
+		f << endl;
+	}
+	f.close();
+
+	candidate &b = scored[ best ];
+	if ( !b.valid ){
+		cout << "[autotune." << __FUNCTION__ << "] Every candidate failed, no config written. The candidates are in " << tName << endl;
+		return;
+	}
+
+	// the config of the best candidate as a calibrate job
+	xmlConfig c = candidateConfig( best );
+	c.set( "jobType", "calibrate" );
+	string cName = baseName + config.getAsString( "tuneOutput", "tuned.xml" );
+	if ( !c.write( cName ) )
+		cout << "[autotune." << __FUNCTION__ << "] Cannot write " << cName << endl;
+
+	cout << "[autotune." << __FUNCTION__ << "] Best of " << scored.size() << " candidates : score " << score( best ) << ", resolution " << b.resolution << " ns, vz width " << b.vzResolution << " cm" << endl;
+	for ( unsigned int i = 0; i < options.size(); i++ )
+		cout << "[autotune." << __FUNCTION__ << "]     " << options[ i ] << " = " << values[ i ][ best[ i ] ] << endl;
+	cout << "[autotune." << __FUNCTION__ << "] Written to " << cName << " and " << tName << endl;
+}
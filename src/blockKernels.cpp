@@ -0,0 +1,139 @@
+
+#include "blockKernels.h"
+#include <algorithm>
+#include <cmath>
+
+// one version per instruction set, picked at load time by the cpu features
+#if defined( __GNUC__ ) && !defined( __clang__ ) && defined( __x86_64__ ) && __GNUC__ >= 6
+#define BLOCK_KERNEL __attribute__(( target_clones( "avx2", "default" ) ))
+#else
+#define BLOCK_KERNEL
+#endif
+
+template< typename T > BLOCK_KERNEL
+void blockKernels::subtract( const T * in, T off, T * out ){
+	for ( int l = 0; l < width; l++ )
+		out[ l ] = in[ l ] - off;
+}
+
+template< typename T > BLOCK_KERNEL
+void blockKernels::subtractRows( const T * a, const T * b, T * out ){
+	for ( int l = 0; l < width; l++ )
+		out[ l ] = a[ l ] - b[ l ];
+}
+
+template< typename T > BLOCK_KERNEL
+uint32_t blockKernels::rangeMask( const T * x, T lo, T hi, bool closedHigh ){
+	int pass[ width ];
+	if ( closedHigh ){
+		for ( int l = 0; l < width; l++ )
+			pass[ l ] = !( x[ l ] <= lo || x[ l ] > hi );
+	} else {
+		for ( int l = 0; l < width; l++ )
+			pass[ l ] = !( x[ l ] <= lo || x[ l ] >= hi );
+	}
+	uint32_t m = 0;
+	for ( int l = 0; l < width; l++ )
+		m |= ( uint32_t )pass[ l ] << l;
+	return m;
+}
+
+template< typename T > BLOCK_KERNEL
+uint32_t blockKernels::thresholdMask( const T * x, T threshold ){
+	uint32_t m = 0;
+	for ( int l = 0; l < width; l++ )
+		m |= ( uint32_t )( !( threshold > x[ l ] ) ) << l;
+	return m;
+}
+
+/**
+ * Counts the edges below each value instead of searching, for increasing
+ * edges this is 1 + the index of the last edge <= x, which is the bin
+ */
+template< typename T > BLOCK_KERNEL
+void blockKernels::findBins( const T * x, const T * edges, int nBins, int * bins ){
+	int count[ width ];
+	for ( int l = 0; l < width; l++ )
+		count[ l ] = 0;
+	for ( int k = 0; k <= nBins; k++ ){
+		T e = edges[ k ];
+		for ( int l = 0; l < width; l++ )
+			count[ l ] += ( e <= x[ l ] );
+	}
+	// anything not below the last edge ( including nan ) is overflow
+	T last = edges[ nBins ];
+	for ( int l = 0; l < width; l++ )
+		bins[ l ] = ( x[ l ] < last ) ? count[ l ] : nBins + 1;
+}
+
+/**
+ * Same steps as TAxis::FindBin for variable bins, the search is TMath::BinarySearch
+ */
+int blockKernels::findBin( const double * edges, int nBins, double x ){
+	if ( x < edges[ 0 ] )
+		return 0;
+	if ( !( x < edges[ nBins ] ) )
+		return nBins + 1;
+
+	const double * p = lower_bound( edges, edges + nBins + 1, x );
+	if ( p != edges + nBins + 1 && *p == x )
+		return 1 + (int)( p - edges );
+	return (int)( p - edges );
+}
+
+bool blockKernels::increasing( const double * edges, int nBins ){
+	for ( int k = 0; k < nBins; k++ ){
+		if ( !( edges[ k ] < edges[ k + 1 ] ) )
+			return false;
+	}
+	return true;
+}
+
+void blockKernels::roundUp( const double * edges, int n, float * out ){
+	for ( int k = 0; k < n; k++ ){
+		float f = (float)edges[ k ];
+		if ( (double)f < edges[ k ] )
+			f = nextafterf( f, HUGE_VALF );
+		out[ k ] = f;
+	}
+}
+
+template< typename T > BLOCK_KERNEL
+void blockKernels::gather( const T * table, const int * bins, int maxIndex, T * out ){
+	for ( int l = 0; l < width; l++ ){
+		int b = bins[ l ] < maxIndex ? bins[ l ] : maxIndex;
+		out[ l ] = table[ b ];
+	}
+}
+
+template< typename T > BLOCK_KERNEL
+void blockKernels::select( const int * bins, int keepBin, const T * alt, T * out ){
+	for ( int l = 0; l < width; l++ )
+		out[ l ] = ( bins[ l ] == keepBin ) ? out[ l ] : alt[ l ];
+}
+
+template< typename T > BLOCK_KERNEL
+void blockKernels::sideSums( const T ( * rows )[ width ], int first, int last, const uint64_t * masks, T * sums ){
+	for ( int l = 0; l < width; l++ )
+		sums[ l ] = 0;
+	for ( int ch = first; ch < last; ch++ ){
+		for ( int l = 0; l < width; l++ ){
+			// rows of channels that are not set may hold anything
+			sums[ l ] += ( ( masks[ l ] >> ch ) & 1 ) ? rows[ ch ][ l ] : T( 0 );
+		}
+	}
+}
+
+// the instantiations used by calib
+#define BLOCK_KERNEL_TYPE( T ) \
+	template void blockKernels::subtract< T >( const T *, T, T * ); \
+	template void blockKernels::subtractRows< T >( const T *, const T *, T * ); \
+	template uint32_t blockKernels::rangeMask< T >( const T *, T, T, bool ); \
+	template uint32_t blockKernels::thresholdMask< T >( const T *, T ); \
+	template void blockKernels::findBins< T >( const T *, const T *, int, int * ); \
+	template void blockKernels::gather< T >( const T *, const int *, int, T * ); \
+	template void blockKernels::select< T >( const int *, int, const T *, T * ); \
+	template void blockKernels::sideSums< T >( const T ( * )[ width ], int, int, const uint64_t *, T * );
+
+BLOCK_KERNEL_TYPE( double )
+BLOCK_KERNEL_TYPE( float )
@@ -0,0 +1,84 @@
+
+#include "bootstrapSums.h"
+#include "utils.h"
+#include <cmath>
+
+void bootstrapSums::configure( int nReplicas, int nBins ){
+	if ( nReplicas > maxReplicas )
+		nReplicas = maxReplicas;
+	if ( nReplicas < 0 )
+		nReplicas = 0;
+	this->nReplicas = nReplicas;
+	this->nBins = nBins;
+	clear();
+}
+
+void bootstrapSums::clear(){
+	counts.assign( nReplicas * nBins, 0 );
+	sums.assign( nReplicas * nBins, 0 );
+}
+
+uint64_t bootstrapSums::weights( int run, int evt, int nReplicas, uint8_t * w ){
+
+	// Poisson( 1 ) cdf in units of 1 / 2^16, weights above 8 have a probability of about 1e-6
+	static const uint32_t cdf[] = { 24109, 48218, 60273, 64291, 65296, 65497, 65530, 65535 };
+
+	uint64_t used = 0;
+	uint64_t h = 0;
+	for ( int r = 0; r < nReplicas; r++ ){
+
+		// four 16 bit uniforms per hash
+		if ( 0 == r % 4 )
+			h = jdbUtils::eventHash( run, evt, r / 4 );
+		uint32_t u = (uint32_t)( h >> ( 16 * ( r % 4 ) ) ) & 0xffff;
+
+		int k = 0;
+		while ( k < 8 && u >= cdf[ k ] )
+			k++;
+		w[ r ] = k;
+		if ( k > 0 )
+			used |= ( 1ULL << r );
+	}
+	return used;
+}
+
+void bootstrapSums::fill( int bin, double y, const uint8_t * w, uint64_t used ){
+	if ( bin < 0 || bin >= nBins )
+		return;
+
+	uint32_t * c = &counts[ bin * nReplicas ];
+	double * s = &sums[ bin * nReplicas ];
+	while ( used ){
+		int r = __builtin_ctzll( used );
+		used &= used - 1;
+		c[ r ] += w[ r ];
+		s[ r ] += w[ r ] * y;
+	}
+}
+
+bool bootstrapSums::mean( int bin, int replica, double &m ) const {
+	int i = bin * nReplicas + replica;
+	if ( 0 == counts[ i ] )
+		return false;
+	m = sums[ i ] / counts[ i ];
+	return true;
+}
+
+double bootstrapSums::spread( int bin ) const {
+	if ( bin < 0 || bin >= nBins )
+		return 0;
+
+	double s = 0, s2 = 0;
+	int n = 0;
+	for ( int r = 0; r < nReplicas; r++ ){
+		double m = 0;
+		if ( !mean( bin, r, m ) ) continue;
+		s += m;
+		s2 += m * m;
+		n++;
+	}
+	if ( n < 2 )
+		return 0;
+	double var = ( s2 - s * s / n ) / ( n - 1 );
+	return var > 0 ? sqrt( var ) : 0;
+}
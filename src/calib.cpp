@@ -2,8 +2,15 @@
 #include "constants.h"
 #include "calib.h"
 #include "histoBook.h"
+#include "runGroups.h"
+#include "slidingMedian.h"
 #include <fstream>
 #include <sstream>
+#include <thread>
+#include <iomanip>
+#include <cstdio>
+#include <deque>
+#include <algorithm>
 
 // provides my own string shortcuts etc.
 using namespace jdbUtils;
@@ -49,14 +56,17 @@ calib::calib( TChain* chain, uint nIterations, xmlConfig con )  {
 	for ( int j = 0; j < constants::nChannels; j++){
 		correction[ j ] 	= new double[ numTOTBins + 1 ];
 		totBins[ j ] 		= new double[ numTOTBins + 1 ];
-
-		deadDetector[ j ]	= false;
+		floatCorrection[ j ] 	= new float[ numTOTBins + 1 ];
+		floatTotBins[ j ] 		= new float[ numTOTBins + 1 ];
 	}
+	deadDetector.clear();
 
 	// zero the corrections & offsets
 	for ( int j = 0; j < constants::nChannels; j++){
 		for (int k = 0; k < numTOTBins + 1; k++){
 			correction[ j ] [ k ] = 0;
+			floatCorrection[ j ][ k ] = 0;
+			floatTotBins[ j ][ k ] = 0;
 		}
 		initialOffsets[ j ] = 0;
 		outlierOffsets[ j ] = 0;
@@ -65,8 +75,11 @@ calib::calib( TChain* chain, uint nIterations, xmlConfig con )  {
 	
 	// set the maximum number of iterations
 	maxIterations = nIterations;
+	coldIterations = nIterations;
 
 
+	// paramReport reads no events
+	pico = NULL;
 	if ( "paramReport" != config.getAsString( "jobType" ) ){
 		// keep the chain variable and make the picoDST var
 		_chain = chain;
@@ -102,6 +115,24 @@ calib::calib( TChain* chain, uint nIterations, xmlConfig con )  {
 		avgNTimingCut.push_back( 0.6 );
 	}
 
+	// a warm start begins close to the solution so the cut schedule starts at a tight level
+	warmStartName = config.getAsString( "warmStart", "" );
+	cutOffset = 0;
+	if ( "" != warmStartName ){
+		cutOffset = config.getAsInt( "warmStartCutLevel", (int)max( vzOutlierCut.size(), avgNTimingCut.size() ) - 1 );
+		if ( cutOffset < 0 )
+			cutOffset = 0;
+		maxIterations = config.getAsInt( "warmStartIterations", 2 );
+	}
+
+	// fraction of the events used in each step, the last one is used for all later steps
+	tmp = config.getAsDoubleVector( "eventFraction" );
+	if ( config.nodeExists( "eventFraction" ) && tmp.size() >= 1 )
+		eventFraction = tmp;
+	else
+		eventFraction.push_back( 1.0 );
+	stepFraction = 1.0;
+
 	avgNBackgroundCut = config.getAsDouble( "avgNBackgroundCut", 10 );
 
 
@@ -109,6 +140,7 @@ calib::calib( TChain* chain, uint nIterations, xmlConfig con )  {
    	// default to akima
    	Interpolation::Type type = ROOT::Math::Interpolation::kAKIMA;
    	useSpline = false;
+   	smoothSpline = false;
    	if ( "akima" == config.getAsString( "splineType", "akima" ) ){
     	type = ROOT::Math::Interpolation::kAKIMA;	
     	useSpline = true; 
@@ -118,9 +150,111 @@ calib::calib( TChain* chain, uint nIterations, xmlConfig con )  {
     } else if ( "cspline" == config.getAsString( "splineType" ) ){
     	type =  ROOT::Math::Interpolation::kCSPLINE;	
     	useSpline = true;
+    } else if ( "pspline" == config.getAsString( "splineType" ) ){
+    	// smoothing fit, the interpolation type is only used for drawing
+    	useSpline = true;
+    	smoothSpline = true;
     }
 
     splineType = type;
+    splineSegments = config.getAsInt( "splineSegments", 10 );
+    splineSmoothing = config.getAsDouble( "splineSmoothing", 0.1 );
+
+    nThreads = config.getAsInt( "nThreads", 1 );
+    if ( nThreads <= 0 )
+    	nThreads = std::thread::hardware_concurrency();
+
+    sliceMethod = sliceFitter::methodFromString( config.getAsString( "sliceFit", "root" ) );
+    validateSlices = config.getAsBool( "validateSliceFit", false );
+
+    // keep the events in memory after the first pass
+    inMemory = config.getAsBool( "inMemory", false );
+    activeBlock = NULL;
+    activeBlockIndex = -1;
+    activeLane = 0;
+    totBinsIteration = -1;
+    drawnIteration = -1;
+
+    // double or float, the precision of the stored events and of the block kernels
+    floatCompute = ( "float" == config.getAsString( "precision", "double" ) );
+    if ( floatCompute && !inMemory )
+    	cout << "[calib." << __FUNCTION__ << "] precision = float is only used with inMemory, calibrating in double precision" << endl;
+    floatCompute = floatCompute && inMemory;
+
+    // stop iterating once the corrections and the vertex resolution stop changing
+    stopOnConvergence = config.getAsBool( "stopOnConvergence", false );
+    minIterations = config.getAsInt( "minIterations", 3 );
+    convergeMaxChange = config.getAsDouble( "convergeMaxChange", 0.005 );
+    convergeRmsChange = config.getAsDouble( "convergeRmsChange", 0.002 );
+    convergeVzChange = config.getAsDouble( "convergeVzChange", 0.005 );
+    converged = false;
+    lastVzResolution = -1;
+
+    // per file partials of the first passes, see cacheFirstPass
+    cacheDir = config.getAsString( "cacheDir", "" );
+    cacheSketchBins = config.getAsInt( "cacheSketchBins", 20000 );
+    firstPassCached = false;
+    activeStore = &store;
+    activeFloatStore = &floatStore;
+    loopDone = false;
+    finalResolution = 0;
+
+    // uncertainty of the corrections from replicas filled in the same pass
+    bootstrapReplicas = config.getAsInt( "bootstrapReplicas", 0 );
+    if ( bootstrapReplicas > bootstrapSums::maxReplicas ){
+    	cout << "[calib." << __FUNCTION__ << "] Using the maximum of " << bootstrapSums::maxReplicas << " bootstrap replicas" << endl;
+    	bootstrapReplicas = bootstrapSums::maxReplicas;
+    }
+
+    // the first of crossValidationFolds folds is held out of the correction fits to score the options
+    int cvFolds = config.getAsInt( "crossValidationFolds", 0 );
+    if ( cvFolds > 1 ){
+    	validator.configure( cvFolds, config.getAsInt( "cvFineBins", 1000 ), minTOT, maxTOT );
+    	cvSplineTypes = config.getAsStringVector( "cvSplineTypes" );
+    	if ( cvSplineTypes.empty() ){
+    		const char * types[] = { "none", "linear", "cspline", "akima", "pspline" };
+    		cvSplineTypes.assign( types, types + 5 );
+    	}
+    	cvTOTBins = config.getAsIntVector( "cvTOTBins" );
+    	if ( cvTOTBins.empty() )
+    		cvTOTBins.push_back( numTOTBins );
+    	cvWindow = config.getAsDouble( "cvWindow", 3.0 );
+    }
+
+    // state written after every step for the resume job type
+    writeCheckpoints = config.getAsBool( "checkpoint", true );
+    checkpointName = config.getAsString( "baseName" ) + config.getAsString( "checkpointOutput", "checkpoint.dat" );
+    resumeIteration = -1;
+    for ( int j = 0; j < constants::nChannels; j++ )
+    	resumeTotBinsReady[ j ] = false;
+
+    // wall clock budget for the whole job, the steps are planned to fit, see planBudget
+    jobStart = wallTime();
+    timeBudget = config.getAsDouble( "timeBudget", 0 );
+    budgetReserve = config.getAsDouble( "timeBudgetReserve", 0.1 );
+    stepSeconds = 0;
+    stepLoopSeconds = 0;
+    stepEventsRead = 0;
+
+    // iterative or direct, the direct solver replaces the iterations with two passes
+    directSolve = ( "direct" == config.getAsString( "solver", "iterative" ) );
+    directRidge = config.getAsDouble( "directRidge", 1e-6 );
+    // the normal equations are only needed by the direct solver
+    if ( directSolve ){
+    	for ( int s = 0; s < 2; s++ )
+    		directSides[ s ].setup( constants::nhChannels, numTOTBins );
+    }
+
+    // fill the per pair outlier QA for every Nth event, 0 for never
+    pairQAPrescale = config.getAsInt( "pairQAPrescale", 10 );
+    outlierEvents = 0;
+
+    // cutMean or median, the per side reference time the channels are calibrated against
+    medianReference = ( "median" == config.getAsString( "sideReference", "cutMean" ) );
+
+    // analytic, minuit or compare
+    resolutionFitMethod = config.getAsString( "resolutionFit", "analytic" );
+    cout << "Slice estimator : " << sliceFitter::methodName( sliceMethod ) << ( validateSlices ? " ( validating against FitSlicesY )" : "" ) << endl;
 
 
 
@@ -161,11 +295,11 @@ calib::calib( TChain* chain, uint nIterations, xmlConfig con )  {
 
 
     maskedChannels = config.getAsIntVector( "MaskChannels" );
+    channelMask.clear();
     for ( int i = 0; i < constants::endEast; i++ ){
-    	channelMask[ i ] = false;
     	if ( config.nodeExists( "MaskChannels" ) && maskedChannels.end() != find( maskedChannels.begin(), maskedChannels.end(), i ) ){
     		cout << "Masking Channel " << i << endl;
-    		channelMask[ i ] = true;
+    		channelMask.set( i );
     	}
     }
 
@@ -181,10 +315,15 @@ calib::~calib() {
 	
 	delete book;
 	delete report;
+	// the chain is not deleted, a calibration sharing it attaches it again before reading
+	if ( pico )
+		delete pico;
 	
 	for ( int j = 0; j < constants::nChannels; j++){
 		delete [] correction[j];
 		delete [] totBins[j];
+		delete [] floatCorrection[j];
+		delete [] floatTotBins[j];
 		if ( spline [ j ] )
 			delete spline[ j ];
 	
@@ -274,6 +413,10 @@ void calib::hardCodeTACOffsets(){
  * @return         returns the channel's timing value
  */
 double calib::getX( int channel ) {
+
+	// already mapped and masked when stored
+	if ( activeBlock )
+		return activeBlock->x[ channel ][ activeLane ];
 	
 	if ( channelMask[ channel ] )
 		return 0.0;
@@ -309,6 +452,9 @@ double calib::getX( int channel ) {
  * @return         returns the channel's timing value
  */
 double calib::getY( int channel ){
+	if ( activeBlock )
+		return activeBlock->y[ channel ][ activeLane ];
+
 	if ( channelMask[ channel ] )
 		return 0.0;
 
@@ -361,7 +507,7 @@ void calib::offsets() {
 	// sanity check
 	//_chain->Draw( "(vpdBbqTdcEast - vpdBbqTdcEast[0]) * 0.018 >> hVpdBbqTdcEast", "vpdBbqTdcEast > 0" );
 
-	Int_t nevents = (Int_t)_chain->GetEntries();
+	Int_t nevents = (Int_t)chainEntries();
 	cout << "[calib." << __FUNCTION__ << "] Loaded: " << nevents << " events " << endl;
 
 	book->cd( "initialOffset" );
@@ -369,18 +515,13 @@ void calib::offsets() {
 	// make all the histos the first round
 	if ( ! book->get( "tdc" ) ){
 		
-		if ( doingTrigger() && convertTacToNS ){
-			book->make2D( "tdc", yVariable + " relative to West Channel 1; Detector ; " + yLabel, constants::nChannels, -0.5, constants::nChannels-0.5, 200, 0, 45 );
-		}
-		else if ( doingTrigger() && !convertTacToNS )
-			book->make2D( "tdc", yVariable + " relative to West Channel 1; Detector ; " + yLabel, constants::nChannels, -0.5, constants::nChannels-0.5, 1000, 0, 4096 );
-		else { // not doing trigger
-			book->make2D( "tdc", yVariable + " relative to West Channel 1; Detector ; " + yLabel, constants::nChannels, -0.5, constants::nChannels-0.5, 2000, -550, 550 );
-			
-		}
+		int nTdc = 0;
+		double tdcLo = 0, tdcHi = 0;
+		offsetBinning( nTdc, tdcLo, tdcHi );
+		book->make2D( "tdc", yVariable + " relative to West Channel 1; Detector ; " + yLabel, constants::nChannels, -0.5, constants::nChannels-0.5, nTdc, tdcLo, tdcHi );
 		book->make1D( "tdcMean", yVariable + " relative to West Channel 1; Detector ; " + yLabel, constants::nChannels, -0.5, constants::nChannels-0.5 );
 		book->make2D( "correctedOffsets", "Corrected Initial Offsets", constants::nChannels, -0.5, constants::nChannels-0.5, 2000, -100, 100 );
-		book->make2D( "tdcRaw", "All tdc Values ", constants::nChannels, 0, constants::nChannels, 1000, 0, 51200 );	
+		book->make2D( "tdcRaw", "All tdc Values ", constants::nChannels, 0, constants::nChannels, rawTdcBins, 0, rawTdcMax );	
 		book->make2D( "tdcOffsetRemoved", yVariable + " relative to West Channel 1; Detector ; " + yLabel, constants::nChannels, -0.5, constants::nChannels-0.5, 2000, -100, 100 );
 	}
 	
@@ -388,9 +529,29 @@ void calib::offsets() {
 
 	cout << "[calib." << __FUNCTION__ << "] Made Histograms " << endl;
 
+	// the histograms are the sum of the per file partials, the dead channels are left out as in the loop
+	if ( firstPassCached ){
+		TH2 * hTdc = (TH2*)book->get( "tdc" );
+		TH2 * hRaw = (TH2*)book->get( "tdcRaw" );
+		double nTdc = 0, nRaw = 0;
+		for ( int j : ~deadDetector ){
+			for ( int ib = 0; ib <= firstPass.offsetBins + 1; ib++ ){
+				hTdc->SetBinContent( j + 1, ib, firstPass.offsetContent( j, ib ) );
+				nTdc += firstPass.offsetContent( j, ib );
+			}
+			for ( int ib = 0; ib <= firstPass.rawBins + 1; ib++ ){
+				hRaw->SetBinContent( j + 1, ib, firstPass.rawContent( j, ib ) );
+				nRaw += firstPass.rawContent( j, ib );
+			}
+		}
+		hTdc->SetEntries( nTdc );
+		hRaw->SetEntries( nRaw );
+		nevents = 0;
+	}
+
 	// loop over all events
 	for(Int_t i=0; i<nevents; i++) {
-    	_chain->GetEntry(i);
+    	_chain->GetEntry( chainEntry( i ) );
 
     	progressBar( i, nevents, 75 );
     	if ( !runInRange( pico->run ) ) continue;
@@ -416,11 +577,8 @@ void calib::offsets() {
     	// 	reference = 0;
     	
 
-		for( int j = constants::startWest; j < constants::endEast; j++) {
-
-			
-			// skip dead detectors
-			if ( deadDetector[ j ] ) continue;
+		// skip dead detectors
+		for( int j : ~deadDetector ) {
 
 			int nHits = pico->numHits( j );
 			
@@ -467,11 +625,20 @@ void calib::offsets() {
 		delete tmp;
 	}
 
-	
+	// without the events the offset removed times come from the tdc histogram bins
+	if ( firstPassCached ){
+		for ( int j : ~deadDetector ){
+			for ( int ib = 1; ib <= tdc->GetNbinsY(); ib++ ){
+				double n = tdc->GetBinContent( j + 1, ib );
+				if ( n > 0 )
+					((TH2*)book->get( "tdcOffsetRemoved" ))->Fill( j, tdc->GetYaxis()->GetBinCenter( ib ) - initialOffsets[ j ], n );
+			}
+		}
+	}
 
 	// loop over all events to draw them with offsets removed
 	for(Int_t i=0; i<nevents; i++) {
-    	_chain->GetEntry(i);
+    	_chain->GetEntry( chainEntry( i ) );
 
     	progressBar( i, nevents, 75 );
     	if ( !runInRange( pico->run ) ) continue;
@@ -490,11 +657,8 @@ void calib::offsets() {
     	double reference = getY( refChannel );
     	
 
-		for( int j = constants::startWest; j < constants::endEast; j++) {
-
-			
-			// skip dead detectors
-			if ( deadDetector[ j ] ) continue;
+		// skip dead detectors
+		for( int j : ~deadDetector ) {
 
 			int nHits = pico->numHits( j );
 			
@@ -598,7 +762,7 @@ void calib::updateOffsets() {
 		return;
 	}
 
-	Int_t nevents = (Int_t)_chain->GetEntries();
+	Int_t nevents = (Int_t)chainEntries();
 	cout << "[calib." << __FUNCTION__ << "] Loaded: " << nevents << " events " << endl;
 
 	book->make2D( "tdc", yVariable + " relative to West Channel 1; Detector ; " + yLabel, constants::nChannels, -0.5, constants::nChannels-0.5, 200000, -500, 550 );
@@ -611,7 +775,7 @@ void calib::updateOffsets() {
 
 	// loop over all events
 	for(Int_t i=0; i<1000; i++) {
-    	_chain->GetEntry(i);
+    	_chain->GetEntry( chainEntry( i ) );
 
     	if ( !runInRange( pico->run ) ) continue;
 		
@@ -633,11 +797,8 @@ void calib::updateOffsets() {
     		reference = 0;
     	
     	tEvt ++;
-		for( int j = constants::startWest; j < constants::endEast; j++) {
-
-			
-			// skip dead detectors
-			if ( deadDetector[ j ] ) continue;
+		// skip dead detectors
+		for( int j : ~deadDetector ) {
 
 			int nHits = pico->numHits( j );
 			
@@ -690,7 +851,7 @@ void calib::finalOffsets() {
 	}
 
 
-	Int_t nevents = (Int_t)_chain->GetEntries();
+	Int_t nevents = (Int_t)chainEntries();
 	cout << "[calib." << __FUNCTION__ << "] Loaded: " << nevents << " events " << endl;
 
 	book->cd( "finalOffset" );
@@ -710,7 +871,7 @@ void calib::finalOffsets() {
 
 	// loop over all events
 	for(Int_t i=0; i<nevents; i++) {
-    	_chain->GetEntry(i);
+    	_chain->GetEntry( chainEntry( i ) );
 		
 		progressBar( i, nevents, 75 );
 
@@ -728,11 +889,8 @@ void calib::finalOffsets() {
     	double reference = getY( 0 ) - getCorrection( 0, getX( 0 ) );
     	
 
-		for( int j = constants::startWest; j < constants::endEast; j++) {
-
-			
-			// skip dead detectors
-			if ( deadDetector[ j ] ) continue;
+		// skip dead detectors
+		for( int j : ~deadDetector ) {
 
 			int nHits = pico->numHits( j );
 			
@@ -801,13 +959,19 @@ void calib::binTOT( bool variableBinning ) {
 
 
 
-	Int_t nevents = (int)_chain->GetEntries();
+	Int_t nevents = (int)chainEntries();
 	vector<double> tots[ constants::nChannels];
 
+	// the tot values are only read from the files that are not in the cache
+	if ( !firstPassCached && "" != cacheDir )
+		cacheFirstPass();
+	if ( firstPassCached )
+		nevents = 0;
+
 	cout << "[calib." << __FUNCTION__ << "] Processing " <<  nevents << " events" << endl;
 
 	for(Int_t i=0; i<nevents; i++) {
-    	_chain->GetEntry(i);
+    	_chain->GetEntry( chainEntry( i ) );
 
     	progressBar( i, nevents, 75 );
     	if ( !runInRange( pico->run ) ) continue;
@@ -846,7 +1010,7 @@ void calib::binTOT( bool variableBinning ) {
 	// get a threshold for a dead detector
 	int threshold = 0;
 	for(Int_t i=0; i<constants::nChannels; i++) {
-		Int_t size = tots[i].size();
+		Int_t size = firstPassCached ? firstPass.sketchCount( i ) : tots[i].size();
 		threshold += size;
 	}
 	threshold /= (double)constants::nChannels; // the average of all detectors
@@ -855,7 +1019,7 @@ void calib::binTOT( bool variableBinning ) {
 	// loop through the channels and determine binning
 	for(Int_t i=0; i<constants::nChannels; i++) {
       
-    	Int_t size = tots[i].size();
+    	Int_t size = firstPassCached ? firstPass.sketchCount( i ) : tots[i].size();
       	cout << "[calib.binTOT] Channel[ " << i << " ] : " << size << " hits" << endl;
       	
       	if( size < 100 ) { // check for dead channels
@@ -869,7 +1033,7 @@ void calib::binTOT( bool variableBinning ) {
         	cout  << "[calib.binTOT] VPD Channel [ " << i << " ] is dead! " << "( " << size << " hits)" <<endl;
         	
         	// set this detector to dead
-        	deadDetector[ i ] = true;
+        	deadDetector.set( i );
         	
         	if ( doingTrigger() ){
         		int testBins[] = { 4095, 4095, 4095, 4095, 4095, 4095, 4095, 4095, 4095 };
@@ -885,7 +1049,7 @@ void calib::binTOT( bool variableBinning ) {
 
       	} else { // channel not dead
 
-      		deadDetector[ i ] = false;
+      		deadDetector.reset( i );
 
       		if ( variableBinning ){
 	      		
@@ -899,7 +1063,7 @@ void calib::binTOT( bool variableBinning ) {
 	        	
 	        	for( Int_t j = 1; j < numTOTBins ; j++) {
 
-	        		double d1 = tots[i].at( step * j );
+	        		double d1 = firstPassCached ? firstPass.sketchValue( i, step * j, minTOT, maxTOT ) : tots[i].at( step * j );
 	        		totBins[ i ][ j ] = d1;
 	            	
 	        	}	// loop over tot bins
@@ -933,6 +1097,185 @@ void calib::binTOT( bool variableBinning ) {
 	cout << "[calib." << __FUNCTION__ << "] completed in " << elapsed() << " seconds " << endl;
 }
 
+/**
+ * The y binning of the initial offset histogram, which depends on the timing variable
+ */
+void calib::offsetBinning( int &nBins, double &lo, double &hi ){
+	if ( doingTrigger() && convertTacToNS ){
+		nBins = 200; lo = 0; hi = 45;
+	} else if ( doingTrigger() && !convertTacToNS ){
+		nBins = 1000; lo = 0; hi = 4096;
+	} else { // not doing trigger
+		nBins = 2000; lo = -550; hi = 550;
+	}
+}
+
+/**
+ * Builds the partials of binTOT and offsets for every file of the chain, taking them from the
+ * cache when the file and the config they depend on are unchanged and reading the file otherwise.
+ * New partials are added to the cache. The sum is used by binTOT and offsets in place of the events.
+ */
+void calib::cacheFirstPass(){
+
+	startTimer();
+
+	// the trigger times are read with the tac offsets removed
+	if ( doingTrigger() )
+		hardCodeTACOffsets();
+
+	int nTdc = 0;
+	double tdcLo = 0, tdcHi = 0;
+	offsetBinning( nTdc, tdcLo, tdcHi );
+	firstPass.setup( constants::nChannels, cacheSketchBins, nTdc, rawTdcBins );
+
+	bool useCache = "" != cacheDir;
+	string key = firstPassKey();
+
+	// the entry ranges of the files
+	_chain->GetEntries();
+	Long64_t * treeOffset = _chain->GetTreeOffset();
+	TObjArray * files = _chain->GetListOfFiles();
+	int nFiles = _chain->GetNtrees();
+
+	int nCached = 0, nRead = 0;
+	for ( int f = 0; f < nFiles; f++ ){
+
+		// the indices of this file's entries, only the entries of the entry list when there is one
+		Long64_t first = treeOffset[ f ], last = treeOffset[ f + 1 ];
+		if ( !entryList.empty() ){
+			first = lower_bound( entryList.begin(), entryList.end(), treeOffset[ f ] ) - entryList.begin();
+			last = lower_bound( entryList.begin(), entryList.end(), treeOffset[ f + 1 ] ) - entryList.begin();
+			// a file without entries, e.g. of another run group, is neither hashed nor read
+			if ( first == last ) continue;
+		}
+
+		string name = files->At( f )->GetTitle();
+		string hash = useCache ? filePartial::hashFile( name ) : "";
+		string entry = cacheDir + "/" + hash + "_" + key + ".partial";
+
+		filePartial p;
+		if ( "" != hash && p.read( entry ) && firstPass.add( p ) ){
+			nCached++;
+			continue;
+		}
+
+		p.setup( constants::nChannels, cacheSketchBins, nTdc, rawTdcBins );
+		fillFirstPass( first, last, p, tdcLo, tdcHi );
+		firstPass.add( p );
+		nRead++;
+
+		if ( useCache && ( "" == hash || !p.write( entry ) ) )
+			cout << "[calib." << __FUNCTION__ << "] Cannot cache " << name << " in " << cacheDir << endl;
+	}
+	firstPassCached = true;
+
+	cout << "[calib." << __FUNCTION__ << "] " << nCached << " files from the cache, " << nRead << " files read, " << firstPass.events << " events " << endl;
+	cout << "[calib." << __FUNCTION__ << "] completed in " << elapsed() << " seconds " << endl;
+}
+
+/**
+ * Hash of the options the events read by this calibration depend on
+ */
+string calib::inputKey(){
+	stringstream sstr;
+	sstr << xVariable << " " << yVariable << " " << channelMask.raw() << " "
+		<< mapTriggerToTof << " " << config.getAsString( "channelMap" ) << " " << convertTacToNS << " " << TACToNS << " "
+		<< firstRun << " " << lastRun << " " << minNTofHits << " " << entryList.size();
+	return filePartial::hashString( sstr.str() );
+}
+
+/**
+ * Hash of everything the first pass partials depend on other than the file
+ */
+string calib::firstPassKey(){
+	int nTdc = 0;
+	double tdcLo = 0, tdcHi = 0;
+	offsetBinning( nTdc, tdcLo, tdcHi );
+
+	stringstream sstr;
+	sstr << "v1 " << inputKey() << " " << minTOT << " " << maxTOT << " " << cacheSketchBins << " "
+		<< nTdc << " " << tdcLo << " " << tdcHi << " " << refChannel;
+	return filePartial::hashString( sstr.str() );
+}
+
+/**
+ * Uses the first pass partials of another calibration of the same data instead of reading them
+ * @return false if the partials depend on options that differ
+ */
+bool calib::shareFirstPass( calib &other ){
+	if ( !other.firstPassCached || other.firstPassKey() != firstPassKey() )
+		return false;
+	firstPass = other.firstPass;
+	firstPassCached = true;
+	return true;
+}
+
+/**
+ * Uses the in memory events of another calibration of the same data instead of loading them
+ * @return false if the other calibration has no events or reads them differently
+ */
+bool calib::shareEvents( calib &other ){
+	if ( !inMemory || 0 == other.storedEvents() || floatCompute != other.floatCompute || other.inputKey() != inputKey() )
+		return false;
+	activeStore = other.activeStore;
+	activeFloatStore = other.activeFloatStore;
+	return true;
+}
+
+/**
+ * Fills the partial of the entries [ first, last ) ( indices for chainEntry ) with the selections of the
+ * binTOT and offsets loops. Every channel is filled, the dead channels are only known
+ * once all files are merged and are left out then.
+ */
+void calib::fillFirstPass( Long64_t first, Long64_t last, filePartial &p, double tdcLo, double tdcHi ){
+
+	for( Long64_t i = first; i < last; i++ ) {
+    	_chain->GetEntry( chainEntry( i ) );
+
+    	if ( !runInRange( pico->run ) ) continue;
+    	p.events++;
+
+    	// binTOT
+	    if( pico->numberOfVpdWest > constants::minHits ){
+	    	for( int j = constants::startWest; j < constants::endWest; j++) {
+	        	double tot = getX( j );
+	        	if( tot > minTOT && tot < maxTOT ) 
+	          		p.fillSketch( j, tot, minTOT, maxTOT );
+	        }
+	    }
+  		if( pico->numberOfVpdEast > constants::minHits ){
+    		for( int j = constants::startEast; j < constants::endEast; j++) {
+      			double tot = getX( j );
+		        if( tot > minTOT && tot < maxTOT ) 
+	          		p.fillSketch( j, tot, minTOT, maxTOT );
+    		}
+  		}
+
+  		// offsets
+		float vx = pico->vertexX;
+    	float vy = pico->vertexY;
+    	if ( TMath::Sqrt( vx*vx + vy*vy ) > 1 ) continue;
+    	if ( pico->nTofHits <= minNTofHits ) continue;
+    	if ( TMath::Abs( pico->vertexZ ) > 100 ) continue;
+
+    	double reference = getY( refChannel );
+		for( int j = constants::startWest; j < constants::endEast; j++ ) {
+			if ( pico->numHits( j ) < constants::minHits ) 
+				continue;
+
+			double tdc = getY( j );
+	    	double tot = getX( j );
+
+	    	p.rawBin( j, filePartial::fixBin( tdc, p.rawBins, 0, rawTdcMax ) )++;
+
+	    	if ( doingTrigger() && minTriggerTDC > tdc  ) continue;
+	    	if( !doingTrigger() && (tot <= minTOT || tot >= maxTOT || reference == 0) ) continue;
+
+	    	p.offsetBin( j, filePartial::fixBin( tdc - reference, p.offsetBins, tdcLo, tdcHi ) )++;
+		}
+	}
+}
+
 /**
  * Retrieves the Slewing correction for a given tot value for a given channel
  * @param  vpdChannel VPD Channel for the slewing correction 
@@ -949,7 +1292,7 @@ double calib::getCorrection( int vpdChannel, double tot ){
 	}
 
 	// use splines to get the correction value if set to
-	if ( useSpline && spline[ vpdChannel ] && spline[ vpdChannel ]->getSpline() ){
+	if ( useSpline && spline[ vpdChannel ] && spline[ vpdChannel ]->ready() ){
 		//return spline[ vpdChannel ]->getSpline()->Eval( tot );
 		return spline[ vpdChannel ]->eval( tot );
 	}
@@ -968,28 +1311,302 @@ double calib::getCorrection( int vpdChannel, double tot ){
  */
 int calib::binForTOT( int vpdChannel, double tot ){
 
-	stringstream sstr; 
-	sstr << "channel" << vpdChannel;
-	string old = book->cd( sstr.str() );
-	sstr.str("");    	sstr << "it" << (currentIteration - 1) <<  "totcor";	
-	TH1D* tmp = (TH1D*)book->get( sstr.str() );
-	int bin = 0;
-	if ( tmp ){
-		bin = tmp->GetXaxis()->FindBin( tot );
-	} else {
+	updateTotBins();
+	if ( !totBinsReady[ vpdChannel ] ){
 		//cout << "[calib." << __FUNCTION__ << "] Cant Find Tot Bin for tot = " << tot << " in channel : " << vpdChannel << endl;
+		return 0;
+	}
+	
+	return blockKernels::findBin( totBins[ vpdChannel ], numTOTBins, tot );
+}
+
+/**
+ * The bins come from the previous iteration's totcor histograms, which are booked with totBins.
+ * Checks once per iteration which channels have one so that the bin can be found from totBins directly.
+ * The corrections only change between iterations so the float tables are refreshed here as well.
+ */
+void calib::updateTotBins(){
+
+	if ( totBinsIteration == (int)currentIteration )
+		return;
+	totBinsIteration = currentIteration;
+
+	for ( int ch = 0; ch < constants::nChannels; ch++ ){
+		stringstream sstr; 
+		sstr << "channel" << ch;
+		string old = book->cd( sstr.str() );
+		sstr.str("");    	sstr << "it" << (currentIteration - 1) <<  "totcor";	
+		totBinsReady[ ch ] = ( NULL != book->get( sstr.str() ) );
+		book->cd( old );
+
+		// the previous iteration ran before the job was resumed so its histograms are not in the book
+		if ( (int)currentIteration == resumeIteration )
+			totBinsReady[ ch ] = resumeTotBinsReady[ ch ];
+
+		totBinsIncreasing[ ch ] = blockKernels::increasing( totBins[ ch ], numTOTBins );
+
+		// single precision tables for the float kernels
+		if ( floatCompute ){
+			blockKernels::roundUp( totBins[ ch ], numTOTBins + 1, floatTotBins[ ch ] );
+			for ( int k = 0; k <= numTOTBins; k++ )
+				floatCorrection[ ch ][ k ] = (float)correction[ ch ][ k ];
+		}
+	}
+}
+
+/**
+ * The slewing correction of a channel in the current event
+ * From the block kernels when reading from memory, otherwise from getCorrection
+ * @param  vpdChannel VPD Channel for the slewing correction
+ * @return            The TDC correction at the channel's current x value
+ */
+double calib::eventCorrection( int vpdChannel ){
+	if ( activeBlock )
+		return blockCor[ vpdChannel ][ activeLane ];
+	return getCorrection( vpdChannel, getX( vpdChannel ) );
+}
+
+/**
+ * The event level cuts of the calibration step, applied to the current chain entry
+ */
+bool calib::passEventCuts(){
+
+	if ( !runInRange( pico->run ) ) return false;
+
+	float vx = pico->vertexX;
+	float vy = pico->vertexY;
+	float vxy = TMath::Sqrt( vx*vx + vy*vy );
+	if ( vxy > 1 ) return false;
+
+	double tpcZ = pico->vertexZ;
+	if ( pico->nTofHits <= minNTofHits ) return false;
+	if ( TMath::Abs( tpcZ ) > 100 ) return false;
+
+	return true;
+}
+
+/**
+ * Moves to event i of the calibration step
+ * @param  i       event index, in the chain or in the store
+ * @param  nevents number of events for the progress bar
+ * @return         false if the event fails the event cuts
+ */
+bool calib::nextEvent( Int_t i, Int_t nevents ){
+
+	progressBar( i, nevents, 75 );
+
+	// only the run is read for the events that are not sampled
+	// the events are counted before the event cuts in both modes so that the same events are sampled
+	if ( stepFraction < 1 ){
+		long n = 0;
+		if ( inMemory ){
+			int iBlock = i / eventBlock::width;
+			int lane = i % eventBlock::width;
+			n = floatCompute ? activeFloatStore->block( iBlock ).runEntry[ lane ] : activeStore->block( iBlock ).runEntry[ lane ];
+		} else {
+			Long64_t entry = pico->LoadTree( chainEntry( i ) );
+			if ( entry < 0 || !pico->b_run ) return false;
+			pico->b_run->GetEntry( entry );
+			n = sampleCounts[ pico->run ]++;
+		}
+		if ( !sampled( n ) ) return false;
+	}
+
+	if ( inMemory ){
+		int iBlock = i / eventBlock::width;
+		activeLane = i % eventBlock::width;
+		// the per block work is done when entering the block
+		if ( iBlock != activeBlockIndex ){
+			activeBlock = NULL;
+			if ( floatCompute ){
+				const floatEventBlock &fb = activeFloatStore->block( iBlock );
+				prepareBlock( fb, floatTotBins, floatCorrection );
+				floatBlockValues.assign( fb );
+			} else 
+				prepareBlock( activeStore->block( iBlock ), totBins, correction );
+			activeBlockIndex = iBlock;
+		}
+		activeBlock = floatCompute ? &floatBlockValues : &activeStore->block( iBlock );
+		return true;
+	}
+
+	_chain->GetEntry( chainEntry( i ) );
+	return passEventCuts();
+}
+
+/**
+ * Systematic sampling within each run, the n-th event of a run is used when
+ * floor( n * stepFraction ) increases. Every run contributes the same fraction of its events
+ * and the same events are picked on every pass over the same data.
+ * @param  n   position of the event among the chain entries of its run
+ * @return     true if the event is sampled in this step
+ */
+bool calib::sampled( long n ){
+	return (long)( ( n + 1 ) * stepFraction ) > (long)( n * stepFraction );
+}
+
+/**
+ * Reads the events into memory unless they are already there or inMemory is off
+ */
+void calib::loadEventStore(){
+	if ( !inMemory || storedEvents() > 0 )
+		return;
+	if ( floatCompute )
+		loadEvents( floatStore );
+	else
+		loadEvents( store );
+}
+
+/**
+ * Reads every event passing the event cuts into the in memory store
+ * @param events the double or float store
+ */
+template< typename T >
+void calib::loadEvents( basicEventStore< T > &events ){
+
+	cout << "[calib." << __FUNCTION__ << "] " << " Start " << endl;
+	startTimer();
+
+	events.clear();
+	activeBlock = NULL;
+	activeBlockIndex = -1;
+
+	// entries of each run before the cuts, for the sampling
+	map<int, long> runEntries;
+
+	Int_t nevents = (Int_t)chainEntries();
+	for ( Int_t i = 0; i < nevents; i++ ){
+		_chain->GetEntry( chainEntry( i ) );
+		progressBar( i, nevents, 75 );
+		long runEntry = runEntries[ pico->run ]++;
+		if ( !passEventCuts() ) continue;
+
+		double x[ constants::nChannels ], y[ constants::nChannels ];
+		for ( int ch = 0; ch < constants::nChannels; ch++ ){
+			x[ ch ] = getX( ch );
+			y[ ch ] = getY( ch );
+		}
+
+		// float times are kept relative to the first hit so that they stay at the ps level,
+		// the trigger times are compared to minTriggerTDC as they are
+		double ref = 0;
+		if ( sizeof( T ) < sizeof( double ) && !doingTrigger() ){
+			for ( int ch = 0; ch < constants::nChannels; ch++ ){
+				if ( x[ ch ] > minTOT && x[ ch ] < maxTOT ){
+					ref = floor( y[ ch ] );
+					break;
+				}
+			}
+		}
+
+		int lane = 0;
+		basicEventBlock< T > &b = events.add( lane );
+		for ( int ch = 0; ch < constants::nChannels; ch++ ){
+			b.x[ ch ][ lane ] = x[ ch ];
+			b.y[ ch ][ lane ] = y[ ch ] - ref;
+		}
+		b.yRef[ lane ] = ref;
+		b.vertexZ[ lane ] = pico->vertexZ;
+		b.run[ lane ] = pico->run;
+		b.evt[ lane ] = pico->evt;
+		b.runEntry[ lane ] = runEntry;
+	}
+	events.finish();
+
+	cout << "[calib." << __FUNCTION__ << "] Stored " << events.size() << " of " << nevents << " events ( " << events.megabytes() << " MB, " << ( floatCompute ? "float" : "double" ) << " ) in " << elapsed() << " seconds " << endl;
+}
+
+/**
+ * Runs the kernels over a block : correction lookup, offset subtraction, the range check
+ * and the side sums used by the outlier rejection
+ * The kernels run in the precision of the block, the results are kept in double
+ * The outlier times are relative to the event's yRef, only their differences are used
+ * @param b      the block of events
+ * @param edges  the tot bin edges of each channel, totBins or floatTotBins
+ * @param tables the corrections of each channel, correction or floatCorrection
+ */
+template< typename T >
+void calib::prepareBlock( const basicEventBlock< T > &b, const T * const * edges, const T * const * tables ){
+
+	updateTotBins();
+
+	const int width = eventBlock::width;
+	bool trigger = doingTrigger();
+	bool splines = useSpline;
+	uint64_t hits[ width ];
+	for ( int l = 0; l < width; l++ )
+		hits[ l ] = 0;
+
+	T cor[ constants::nChannels ][ width ];
+	T outlierTime[ constants::nChannels ][ width ];
+	T sumWest[ width ], sumEast[ width ];
+
+	channelSet alive = ~deadDetector;
+	for ( int ch = 0; ch < constants::nChannels; ch++ ){
+
+		// the corrections, same choice between bins and spline as getCorrection
+		int bins[ width ];
+		if ( totBinsReady[ ch ] && totBinsIncreasing[ ch ] )
+			blockKernels::findBins( b.x[ ch ], edges[ ch ], numTOTBins, bins );
+		else {
+			for ( int l = 0; l < width; l++ )
+				bins[ l ] = binForTOT( ch, b.x[ ch ][ l ] );
+		}
+		blockKernels::gather( tables[ ch ], bins, numTOTBins, cor[ ch ] );
+		if ( splines && spline[ ch ] && spline[ ch ]->ready() ){
+			// the spline is always evaluated in double
+			double sX[ width ], sCor[ width ];
+			T alt[ width ];
+			for ( int l = 0; l < width; l++ )
+				sX[ l ] = b.x[ ch ][ l ];
+			spline[ ch ]->eval( sX, sCor, width );
+			for ( int l = 0; l < width; l++ )
+				alt[ l ] = (T)sCor[ l ];
+			blockKernels::select( bins, numTOTBins, alt, cor[ ch ] );
+		}
+
+		// times for the outlier rejection
+		T pre[ width ];
+		blockKernels::subtract( b.y[ ch ], (T)( this->initialOffsets[ ch ] + this->outlierOffsets[ ch ] ), pre );
+		blockKernels::subtractRows( pre, cor[ ch ], outlierTime[ ch ] );
+
+		if ( !alive[ ch ] ) continue;
+		uint32_t pass = 0;
+		if ( trigger )
+			pass = blockKernels::thresholdMask( pre, (T)minTriggerTDC );
+		else {
+			// against the double bounds like getX in the step
+			double x[ width ];
+			for ( int l = 0; l < width; l++ )
+				x[ l ] = b.x[ ch ][ l ];
+			pass = blockKernels::rangeMask( x, minTOT, maxTOT, false );
+		}
+
+		for ( uint32_t m = pass; m; m &= m - 1 )
+			hits[ __builtin_ctz( m ) ] |= ( uint64_t )1 << ch;
 	}
-	book->cd( old );
 
-	return bin;
+	blockKernels::sideSums( outlierTime, constants::startWest, constants::endWest, hits, sumWest );
+	blockKernels::sideSums( outlierTime, constants::startEast, constants::endEast, hits, sumEast );
 
+	for ( int ch = 0; ch < constants::nChannels; ch++ ){
+		for ( int l = 0; l < width; l++ ){
+			blockCor[ ch ][ l ] = cor[ ch ][ l ];
+			blockOutlierTime[ ch ][ l ] = outlierTime[ ch ][ l ];
+		}
+	}
+	for ( int l = 0; l < width; l++ ){
+		blockSumWest[ l ] = sumWest[ l ];
+		blockSumEast[ l ] = sumEast[ l ];
+		blockOutlierHits[ l ] = channelSet( hits[ l ] );
+	}
 }
 
 /**
  * Performs the outlier rejection calculations for each event.
- * Calculates the VPD zVertex for all combinations of east and west detectors
- * and uses the detectors only in pairs which are within a given cut from the TPC
- * zVertex
+ * Finds all combinations of east and west detectors whose VPD zVertex is within a 
+ * given cut from the TPC zVertex and uses only the detectors in those pairs.
+ * The pairs are found from the sorted times, see vertexMatcher
  * @param reject 
  *        True 		Performs outlier reject
  *        False 	Uses all detectors, all events
@@ -1002,11 +1619,11 @@ void calib::outlierRejection( bool reject ) {
 	
 
 	// get the TPC z vertex
-	double tpcZ = pico->vertexZ;
+	double tpcZ = activeBlock ? activeBlock->vertexZ[ activeLane ] : pico->vertexZ;
 
 	double vzCut = 40;
-	if ( currentIteration < vzOutlierCut.size() )
-		vzCut = vzOutlierCut[ currentIteration ];	// use the cut for this step
+	if ( cutLevel() < vzOutlierCut.size() )
+		vzCut = vzOutlierCut[ cutLevel() ];	// use the cut for this step
 	else 
 		vzCut = vzOutlierCut[ vzOutlierCut.size() - 1 ];	// after that use the last cut defined for all other steps
 
@@ -1015,9 +1632,7 @@ void calib::outlierRejection( bool reject ) {
 	int numValidPairs = 0;
 
 	// reset the state
-	for ( int j = constants::startWest; j < constants::endEast; j++ ){
-		useDetector[ j ] = false;
-	}
+	useDetector.clear();
 
 	eastIsGood = false;
 	westIsGood = false;
@@ -1026,73 +1641,78 @@ void calib::outlierRejection( bool reject ) {
 	double sumWest = 0;
 	double countEast = 0;
 	double countWest = 0;
-	stringstream sstr;
 
-	bool summedEast = false;
-	
-	for ( int j = constants::startWest; j < constants::endWest; j++ ){
-
-		if ( deadDetector[ j ] ) continue;
-
-		double tdcWest = getY( j );
-	    double totWest = getX( j );
+	// corrected times of the usable tubes on each side
+	double tWest[ constants::nhChannels ], tEast[ constants::nhChannels ];
+	int chWest[ constants::nhChannels ], chEast[ constants::nhChannels ];
+	uint32_t matchWest = 0, matchEast = 0;
+	int nWest = 0, nEast = 0;
+
+	// the corrected times and side sums were already made for the whole block
+	if ( activeBlock ){
+		channelSet pass = blockOutlierHits[ activeLane ];
+		for ( int j : pass.west() ){
+			tWest[ nWest ] = blockOutlierTime[ j ][ activeLane ];
+			chWest[ nWest++ ] = j;
+		}
+		for ( int j : pass.east() ){
+			tEast[ nEast ] = blockOutlierTime[ j ][ activeLane ];
+			chEast[ nEast++ ] = j;
+		}
+		sumWest = blockSumWest[ activeLane ];
+		sumEast = blockSumEast[ activeLane ];
+		countWest = nWest;
+		countEast = nEast;
+	}
 
-	    tdcWest -= (this->initialOffsets[ j ] + this->outlierOffsets[ j ]);
+	// otherwise correct each tube here
+	channelSet toCorrect = activeBlock ? channelSet() : ~deadDetector;
+	for ( int j : toCorrect ){
 
-	  	if ( doingTrigger() && minTriggerTDC > tdcWest ) continue;
-	    if( !doingTrigger() && (totWest <= minTOT || totWest >= maxTOT ) ) continue;
-	    
-	    double corWest = getCorrection( j, totWest );
-	    tdcWest -= corWest;
+		double tdc = getY( j );
+	    double tot = getX( j );
 
-	    sumWest += tdcWest;
-	    countWest++;
+	    tdc -= (this->initialOffsets[ j ] + this->outlierOffsets[ j ]);
 
+	  	if ( doingTrigger() && minTriggerTDC > tdc ) continue;
+	    if( !doingTrigger() && (tot <= minTOT || tot >= maxTOT ) ) continue;
 	    
+	    tdc -= eventCorrection( j );
+
+	    if ( j < constants::endWest ){
+	    	sumWest += tdc;
+	    	countWest++;
+	    	tWest[ nWest ] = tdc;
+	    	chWest[ nWest++ ] = j;
+	    } else {
+	    	sumEast += tdc;
+	    	countEast++;
+	    	tEast[ nEast ] = tdc;
+	    	chEast[ nEast++ ] = j;
+	    }
+	}
 
-		for ( int k = constants::startEast; k < constants::endEast; k++ ){
-			
-			if ( deadDetector[ k ] ) continue;
-
-			double tdcEast = getY( k );
-	    	double totEast = getX( k );
-
-	    	tdcEast -= (this->initialOffsets[ k ] + this->outlierOffsets[ k ]);
-
-	    	if ( doingTrigger() && minTriggerTDC > tdcEast ) continue;
-	    	if( !doingTrigger() && (totEast <= minTOT || totEast >= maxTOT ) ) continue;
-	    	
-	    	double corEast = getCorrection( k, totEast );
-	    	tdcEast -= corEast;
-
-	    	if ( summedEast == false ){
-	    		sumEast += tdcEast;
-	    		countEast++;
-	    	}
-
-	    	// calculate the VPD z Vertex
-	    	double vpdZ = constants::c * ( tdcEast - tdcWest) / 2.0;
-	    	if ( doingTrigger() )
-	    		vpdZ = constants::c * ( tdcWest - tdcEast) / 2.0;
-
-	    	book->get( iStr+"All" )->Fill( tpcZ - vpdZ );
-	    	book->get( iStr +"zTPCzVPD" )->Fill( tpcZ, vpdZ );
-	    	
-
-	    	if ( TMath::Abs( tpcZ - vpdZ ) < vzCut  ){
-
-	    		// valid pair
-	    		useDetector[ k ] = true;
-	    		useDetector[ j ] = true;
-	    		eastIsGood = true;
-	    		westIsGood = true;
-	    		numValidPairs ++ ;
+	numValidPairs = vertexMatcher::match( 	tWest, nWest, tEast, nEast, tpcZ, vzCut, doingTrigger(),
+											matchWest, matchEast );
+	for ( uint32_t m = matchWest; m; m &= m - 1 )
+		useDetector.set( chWest[ __builtin_ctz( m ) ] );
+	for ( uint32_t m = matchEast; m; m &= m - 1 )
+		useDetector.set( chEast[ __builtin_ctz( m ) ] );
+	if ( numValidPairs > 0 ){
+		eastIsGood = true;
+		westIsGood = true;
+	}
 
-	    	} 
-		    	  			
-		} // loop channel k
-		summedEast = true;
-	} // loop channel j
+	// the every pair QA is only filled for a sample of the events
+	if ( pairQAPrescale > 0 && 0 == ( outlierEvents++ % pairQAPrescale ) ){
+		for ( int j = 0; j < nWest; j++ ){
+			for ( int k = 0; k < nEast; k++ ){
+				double vpdZ = vertexMatcher::vertex( tWest[ j ], tEast[ k ], doingTrigger() );
+		    	book->get( iStr+"All" )->Fill( tpcZ - vpdZ );
+		    	book->get( iStr +"zTPCzVPD" )->Fill( tpcZ, vpdZ );
+			}
+		}
+	}
 
 	// cout << "CountEast = " << countEast << ", countWest = " << countWest << endl;
 	if ( countEast >= 1 && countWest >= 1){
@@ -1106,28 +1726,12 @@ void calib::outlierRejection( bool reject ) {
 
 	book->fill( iStr+"nValidPairs", numValidPairs );
 
-	int nAccepted = 0;
-	for ( int j = constants::startWest; j < constants::endWest; j++ ){
-		if( useDetector[ j ] )
-			nAccepted ++;
-	}
-
-
-	book->fill( iStr+"nAcceptedWest", nAccepted );
-
-	nAccepted = 0;
-	for ( int j = constants::startEast; j < constants::endEast; j++ ){
-		if( useDetector[ j ] )
-			nAccepted ++;
-	}
-
-	book->fill( iStr+"nAcceptedEast", nAccepted );
+	book->fill( iStr+"nAcceptedWest", useDetector.west().count() );
+	book->fill( iStr+"nAcceptedEast", useDetector.east().count() );
 
 	if ( reject == false ){
 		// reset the state
-		for ( int j = constants::startWest; j < constants::endEast; j++ ){
-			useDetector[ j ] = true;
-		}
+		useDetector = channelSet::all();
 		westIsGood = true;
 		eastIsGood = true;
 		return;
@@ -1155,8 +1759,7 @@ void calib::prepareStepHistograms() {
 		string title2D = step + sCh + " " + yVariable + " vs " + xVariable + ";" + xLabel + ";" + yLabel ;
 		string title1D = step + sCh + " " + yVariable + ";" + yLabel + "; [ # ] "  ;
 
-		int tdcTot_y = 40;
-		book->make2D( 	iStr + "tdctot", 	title2D, numTOTBins , totBins[ ch ], 1000, -tdcTot_y, tdcTot_y );
+		book->make2D( 	iStr + "tdctot", 	title2D, numTOTBins , totBins[ ch ], 1000, -tdcTotRange, tdcTotRange );
 		book->make2D( 	iStr + "tdccor", 	title2D, numTOTBins , totBins[ ch ], 1000, -20, 20 );
 		book->make1D( 	iStr + "tdc", 		title1D, 500, -10, 10 );
 		book->make2D( 	iStr + "avgN", 		step + sCh + " : 1 - <N>;# of Detectors;" + yLabel, 
@@ -1165,6 +1768,25 @@ void calib::prepareStepHistograms() {
 							constants::nChannels/2, 1, constants::nChannels/2, 1000, -20, 20 );
 	}
 
+	prepareOutlierHistograms();
+
+	// offsets
+	book->cd( "initialOffset" );
+	book->make2D( 	iStr + "Offsets", step + yLabel + " wrt West Channel 1; Detector ; [#] ",
+							constants::nChannels, -0.5, constants::nChannels-0.5, 2000, -100, 100 );
+
+	cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] " << " Histograms Booked " << endl;
+
+}
+
+/**
+ * Prepares the outlier rejection histograms of a step, also used by the direct pass
+ */
+void calib::prepareOutlierHistograms() {
+
+	string iStr = "it"+ts(currentIteration);
+	string step = "Step " + ts( currentIteration+1 ) + " : ";
+
 	/*
 	* outlier rejection histos
 	*/
@@ -1188,14 +1810,6 @@ void calib::prepareStepHistograms() {
 	/*
 	* outlier rejection histos
 	*/
-
-	// offsets
-	book->cd( "initialOffset" );
-	book->make2D( 	iStr + "Offsets", step + yLabel + " wrt West Channel 1; Detector ; [#] ",
-							constants::nChannels, -0.5, constants::nChannels-0.5, 2000, -100, 100 );
-
-	cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] " << " Histograms Booked " << endl;
-
 }
 
 
@@ -1211,6 +1825,12 @@ void calib::step( ) {
 	//updateOffsets();
 
 	cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] " << " Start " << endl;
+
+	// the first pass reads the chain into memory
+	loadEventStore();
+
+	// timed after the load, which is only done once and counts as time already used for the budget
+	double stepStart = wallTime();
 	
 	startTimer();
 
@@ -1218,11 +1838,20 @@ void calib::step( ) {
 	bool removeOffset = config.getAsBool( "removeOffset" );
 
 	double outlierCut = 2;
-	if ( currentIteration < avgNTimingCut.size() )
-		outlierCut = avgNTimingCut[ currentIteration ];	// use the cut for this step
+	if ( cutLevel() < avgNTimingCut.size() )
+		outlierCut = avgNTimingCut[ cutLevel() ];	// use the cut for this step
 	else 
 		outlierCut = avgNTimingCut[ avgNTimingCut.size() - 1 ];	// after that use the last cut defined for all other steps
 
+	// the events sampled in this step
+	if ( currentIteration < eventFraction.size() )
+		stepFraction = eventFraction[ currentIteration ];
+	else
+		stepFraction = eventFraction[ eventFraction.size() - 1 ];
+	sampleCounts.clear();
+	if ( stepFraction < 1 )
+		cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] " << " Using " << stepFraction * 100 << "% of the events in each run" << endl;
+
 	
 	// the data we will use over and over 
 	double tot[ constants::nChannels ];		// tot value
@@ -1235,43 +1864,57 @@ void calib::step( ) {
 	// reference tdc time => the 1st channel on the west side
 	double reference;
 
+	// west and east statistics for each event
+	sideStats sideStat[ 2 ];
+
 	string iStr = "it"+ts(currentIteration);
 	stringstream sstr;
 
 	// make sure the histograms are ready
 	prepareStepHistograms();
 
-	cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] " << " Calibrating " << endl;
+	// the refinement pass of the direct solver
+	if ( directSolve ){
+		for ( int s = 0; s < 2; s++ )
+			directSides[ s ].clear();
+	}
 
-	Int_t nevents = (int)_chain->GetEntries();
-	for(Int_t i = 0; i < nevents; i++) {
-    	_chain->GetEntry(i);
+	// bootstrap replicas of the tdctot profiles
+	uint8_t replicaWeights[ bootstrapSums::maxReplicas ];
+	uint64_t replicaUsed = 0;
+	for ( int k = 0; k < constants::nChannels && bootstrapReplicas > 0; k++ )
+		bootstrap[ k ].configure( bootstrapReplicas, numTOTBins );
 
-    	progressBar( i, nevents, 75 );
-    	if ( !runInRange( pico->run ) ) continue;
+	// the training and validation sums of the cross validation
+	bool heldOut = false;
+	validator.clear();
 
-    
-    	float vx = pico->vertexX;
-    	float vy = pico->vertexY;
-    	float vxy = TMath::Sqrt( vx*vx + vy*vy );
-    	if ( vxy > 1 ) continue;
+	cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] " << " Calibrating " << endl;
 
-    	double tpcZ = pico->vertexZ;
-    	if ( pico->nTofHits <= minNTofHits ) continue;
-    	if ( TMath::Abs( tpcZ ) > 100 ) continue;
+	Int_t nevents = inMemory ? (Int_t)storedEvents() : (int)chainEntries();
+	for(Int_t i = 0; i < nevents; i++) {
+    	if ( !nextEvent( i, nevents ) ) continue;
 
     	// perform outlier rejection for this event
     	outlierRejection( outliers );
 
     	if ( removeOffset )
   		  	averageN();
- 		   	
+
+    	// the replica weights and the fold only depend on the event
+    	if ( bootstrapReplicas > 0 || validator.enabled() ){
+    		int run = activeBlock ? activeBlock->run[ activeLane ] : pico->run;
+    		int evt = activeBlock ? activeBlock->evt[ activeLane ] : pico->evt;
+    		if ( bootstrapReplicas > 0 )
+    			replicaUsed = bootstrapSums::weights( run, evt, bootstrapReplicas, replicaWeights );
+    		heldOut = validator.heldOut( run, evt );
+    	}
+
+    	// the detectors usable in this event
+    	channelSet live = useDetector & ~deadDetector;
 
     	// Alias the values for this event for ease
-    	for( int j = constants::startWest; j < constants::endEast; j++) {
-    		
-    		if ( deadDetector[ j ] ) continue;
-			if ( !useDetector[ j ] ) continue;
+    	for( int j : live ) {
 
     		tot[ j ] = getX( j );
     		tdc[ j ] = getY( j );
@@ -1283,86 +1926,51 @@ void calib::step( ) {
 
     		if( !doingTrigger() && (tot[ j ] <= minTOT || tot[ j ] >= maxTOT) ) continue;
   			
-  			corr[ j ] = getCorrection( j, tot[ j ] );
+  			corr[ j ] = eventCorrection( j );
   			tAll[ j ] -= corr[ j ];
     	}
-    	reference = getY( refChannel ) - getCorrection( refChannel, tot[ refChannel ] );
+    	reference = getY( refChannel ) - eventCorrection( refChannel );
     	if ( doingTrigger() ) 
     		reference = 0;
 
+    	// the channels that enter the plain average and the ones that may pass the timing cut
+    	channelSet inMean, inCut;
+    	for( int k : live ) {
+    		bool inTOT = !(tot[ k ] <= minTOT || tot[ k ] > maxTOT);
+    		if ( doingTrigger() )
+    			inMean.set( k, !( minTriggerTDC > tdc[ k ] ) );
+    		else
+    			inMean.set( k, inTOT );
+    		inCut.set( k, inTOT );
+    	}
+    	sideStat[ 0 ].set( tAll + constants::startWest, inMean.westBits(), inCut.westBits() );
+    	sideStat[ 1 ].set( tAll + constants::startEast, inMean.eastBits(), inCut.eastBits() );
+
+		// channels within the timing cut of the others, used by the direct solver
+		channelSet directHits;
+
 		// loop over every channel on the west and then on the east side
-		for( int j = constants::startWest; j < constants::endEast; j++) {
-			
-			// skip dead detectors
-			if ( deadDetector[ j ] ) continue;
-			if ( !useDetector[ j ] ) continue;
-
-			// require the tot is within range and the tdc is not zero
-			if ( doingTrigger() && minTriggerTDC > tdc[ j ] ) continue;
-	    	if(  (tot[ j ] <= minTOT || tot[ j ] > maxTOT)) continue;
-
-
-	    	double tdcSumWest = 0;
-			double tdcSumEast = 0;
-	    	double countEast = 0;
-	    	double countWest = 0;
-
-	    	for( int k = constants::startWest; k < constants::endEast; k++) {
-
-	    		// skip dead detectors
-				if ( deadDetector[ k ] ) continue;
-				if ( !useDetector[ k ] ) continue;
-	    		
-	    		if ( doingTrigger() && minTriggerTDC > tdc[ k ] ) continue;
-	    		if( !doingTrigger() && (tot[ k ] <= minTOT || tot[ k ] > maxTOT)) continue;
-	    		if ( j == k ) continue;
-	    		
-	    		if ( k >= constants::startWest && k < constants::endWest ){
-	    			tdcSumWest += ( tAll[ k ]);
-	    			countWest ++;
-	    		} else if ( k >= constants::startEast && k < constants::endEast ){
-	    			tdcSumEast += ( tAll[ k ]);
-	    			countEast ++;
-	    		}
+		// the channels with the tot within range ( and the tdc above threshold for the trigger )
+		for( int j : inMean & inCut ) {
 
-			}	// loop on vpdChannel k
+	    	// per side statistics leaving out this channel
+	    	int side = ( j >= constants::startEast && j < constants::endEast ) ? 1 : 0;
+	    	int sideIndex = j - ( side ? constants::startEast : constants::startWest );
 
+	    	double avg = 0;
+	    	int count = sideStat[ side ].mean( sideIndex, avg );
 
-			/*
+	    	/*
 			*	Now recalculate the average times using the previously calculated average to
 			*	apply a cut on the range of variation
 			*/
-			double cutSumWest = 0;
-			double cutSumEast = 0;
-	    	double cutCountEast = 0;
-	    	double cutCountWest = 0;
-
-	    	for( int k = constants::startWest; k < constants::endEast; k++) {
-
-	    		// skip dead detectors
-				if ( deadDetector[ k ] ) continue;
-				if ( !useDetector[ k ] ) continue;
-	    		if ( j == k ) continue;
-	    		if(tot[ k ] <= minTOT || tot[ k ] > maxTOT) continue;
-
-	    		if ( k >= constants::startWest && k < constants::endWest ){
-	    			double tAvg = tdcSumWest / countWest;
-
-	    			if ( tAll[ k ] - tAvg < outlierCut && tAll[ k ] - tAvg > -outlierCut ){
-	    				cutSumWest += tAll[ k ];
-	    				cutCountWest ++;
-	    			}
-	    		} else if ( k >= constants::startEast && k < constants::endEast ){
-	    			double tAvg = tdcSumEast / countEast;
-
-	    			if ( tAll[ k ] - tAvg < outlierCut && tAll[ k ] - tAvg > -outlierCut ){
-	    				cutSumEast += tAll[ k ];
-	    				cutCountEast ++;
-	    			}
-	    		}
-
-			}	// loop on vpdChannel k
-
+	    	double cutAvg = avg;
+	    	if ( removeOffset ){
+	    		if ( medianReference )
+	    			sideStat[ side ].median( sideIndex, cutAvg );
+	    		else 
+	    			sideStat[ side ].cutMean( sideIndex, avg, outlierCut, cutAvg );
+	    	}
 
 			book->cd( "initialOffset" );
 	 		if ( currentIteration == 0 ){
@@ -1372,54 +1980,212 @@ void calib::step( ) {
 		    // now fill the offsets to see how it changes with the cuts / outlier rejection
 		    book->fill( iStr+"Offsets", j, tdc[ j ] - corr[ j ] - (reference - corr[ 0 ]));
 
-		    // set the avg and count varaibles for this run
-		    // if j corresponds to a west channel then use tdcSumWest, countWest
-		    // if j corresponds to an east channel then use tdcSumEast, countEast
-	    	double avg = (tdcSumWest / countWest );
-	    	double cutAvg = ( cutSumWest / cutCountWest );
-	    	int count = countWest;
-	    	int cutCount = cutCountWest;
-
-	    	if ( !removeOffset ){
-	    		cutAvg = avg;
-	    		cutCount = count;
-	    	}
-
-
-	 		if ( j >= constants::startEast && j < constants::endEast ){
-	    		avg = (tdcSumEast / countEast );
-	    		count = countEast;
-	    		
-	    		if ( removeOffset ){
-	    			cutAvg = ( cutSumEast / cutCountEast );
-	    			cutCount = cutCountEast;
-	    		} else {
-	    			cutAvg = avg;
-	    			cutCount = count;
-	    		}
+	    	if ( count <= constants::minHits ) continue;
 
+	    	// the held out events only score the corrections
+	    	if ( validator.enabled() ){
+	    		double residual = tAll[ j ] - cutAvg;
+	    		if ( residual > -cvWindow && residual < cvWindow )
+	    			validator.fill( j, tot[ j ], tdc[ j ] - off[ j ] - cutAvg, heldOut );
+	    		if ( heldOut ) continue;
 	    	}
 
-	    	if ( count <= constants::minHits ) continue;
+	    	if ( directSolve && tAll[ j ] - cutAvg < outlierCut && tAll[ j ] - cutAvg > -outlierCut )
+	    		directHits.set( j );
 
 	    	// change into this channels dir for histogram saving
 			book->cd( "channel" + ts(j) );	    	
 	    	book->fill( iStr+"tdctot", tot[ j ], tdc[ j ] - off[ j ] - cutAvg );
+
+	    	// same entries as the profile of tdctot
+	    	if ( bootstrapReplicas > 0 ){
+	    		double y = tdc[ j ] - off[ j ] - cutAvg;
+	    		if ( y >= -tdcTotRange && y < tdcTotRange )
+	    			bootstrap[ j ].fill( blockKernels::findBin( totBins[ j ], numTOTBins, tot[ j ] ) - 1, y, replicaWeights, replicaUsed );
+	    	}
 	    	book->fill( iStr+"tdccor", tot[ j ], tAll[ j ] - cutAvg );
 	    	book->fill( iStr+"tdc" , tAll[ j ]  - cutAvg );
 	
-		}	
+		}
+
+		if ( directSolve ){
+			double uncorrected[ constants::nChannels ];
+			for ( int j : directHits )
+				uncorrected[ j ] = tdc[ j ] - off[ j ];
+			addDirectHits( directHits, tot, uncorrected );
+		}
 	}
+	// back to reading the chain
+	activeBlock = NULL;
+	activeBlockIndex = -1;
+	stepLoopSeconds = wallTime() - stepStart;
+	stepEventsRead = (long)( stepFraction * nevents );
 
 	cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] " << " completed in " << elapsed() << " seconds " << endl;
 	
+	// the corrections used in this step
+	vector<double> previous;
+	for ( int k = 0; k < constants::nChannels; k++ )
+		previous.insert( previous.end(), correction[ k ], correction[ k ] + numTOTBins + 1 );
+
 	makeCorrections();
+	if ( directSolve )
+		solveDirect();
+	if ( validator.enabled() )
+		crossValidate();
 	
 	stepReport();
 
+	converged = checkConvergence( previous );
+
+	stepSeconds = wallTime() - stepStart;
+	stepFractions.push_back( stepFraction );
+
 	currentIteration++;
+}
 
-	
+/**
+ * First pass of the direct solver. Accumulates the least squares system for the corrections
+ * of all channels from the detectors kept by the outlier rejection and solves it.
+ * Counts as an iteration so that the following step uses the solution.
+ */
+void calib::directPass( ) {
+
+	cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] " << " Start " << endl;
+
+	loadEventStore();
+
+	startTimer();
+
+	bool outliers =  config.getAsBool( "outlierRejection" );
+	bool removeOffset = config.getAsBool( "removeOffset" );
+
+	// the outlier rejection histograms of this pass, the channel histograms are not filled
+	prepareOutlierHistograms();
+
+	// the solver always uses every event
+	stepFraction = 1.0;
+
+	for ( int s = 0; s < 2; s++ )
+		directSides[ s ].clear();
+
+	double tot[ constants::nChannels ];
+	double uncorrected[ constants::nChannels ];
+
+	Int_t nevents = inMemory ? (Int_t)storedEvents() : (int)chainEntries();
+	for( Int_t i = 0; i < nevents; i++ ) {
+		if ( !nextEvent( i, nevents ) ) continue;
+
+		outlierRejection( outliers );
+
+		// same channel selection as the step
+		channelSet hits;
+		for ( int j : useDetector & ~deadDetector ){
+			tot[ j ] = getX( j );
+			double tdc = getY( j );
+			uncorrected[ j ] = tdc - ( removeOffset ? this->initialOffsets[ j ] : 0 );
+
+			bool inTOT = !(tot[ j ] <= minTOT || tot[ j ] > maxTOT);
+			if ( doingTrigger() )
+				hits.set( j, inTOT && !( minTriggerTDC > tdc ) );
+			else
+				hits.set( j, inTOT );
+		}
+		addDirectHits( hits, tot, uncorrected );
+	}
+	activeBlock = NULL;
+	activeBlockIndex = -1;
+
+	cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] " << " completed in " << elapsed() << " seconds " << endl;
+
+	solveDirect();
+
+	currentIteration++;
+}
+
+/**
+ * Adds the hits of the current event to the least squares system of each side
+ * @param hits   the channels to use
+ * @param tot    x value of each channel
+ * @param values time of each channel without the slewing correction
+ */
+void calib::addDirectHits( channelSet hits, const double * tot, const double * values ){
+
+	int channels[ constants::nhChannels ], bins[ constants::nhChannels ];
+	double v[ constants::nhChannels ];
+
+	for ( int s = 0; s < 2; s++ ){
+		int first = ( 0 == s ) ? constants::startWest : constants::startEast;
+		int n = 0;
+		for ( int j : ( 0 == s ) ? hits.west() : hits.east() ){
+			channels[ n ] = j - first;
+			bins[ n ] = blockKernels::findBin( totBins[ j ], numTOTBins, tot[ j ] );
+			v[ n ] = values[ j ];
+			n++;
+		}
+		directSides[ s ].add( channels, bins, v, n );
+	}
+}
+
+/**
+ * Solves the least squares system of each side and replaces the corrections and splines.
+ * The totcor histograms of this iteration hold the solution, like the profiles in makeCorrections
+ */
+void calib::solveDirect( ){
+
+	startTimer();
+	string iStr = "it" + ts( currentIteration );
+
+	for ( int s = 0; s < 2; s++ ){
+		int first = ( 0 == s ) ? constants::startWest : constants::startEast;
+		string side = ( 0 == s ) ? "West" : "East";
+
+		vector<double> c;
+		if ( !directSides[ s ].solve( directRidge, c ) ){
+			cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] " << side << " : cannot solve, keeping the corrections" << endl;
+			continue;
+		}
+
+		long nHits = directSides[ s ].hits();
+		long ndf = nHits - directSides[ s ].events();
+		vector<double> zero( c.size(), 0 );
+		if ( ndf > 0 ){
+			cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] " << side << " : " << directSides[ s ].events() << " events, " << nHits << " hits, rms " 
+				<< sqrt( directSides[ s ].chi2( zero ) / ndf ) << " -> " << sqrt( directSides[ s ].chi2( c ) / ndf ) << " ns" << endl;
+		}
+
+		for ( int k = 0; k < constants::nhChannels; k++ ){
+			int ch = first + k;
+			if ( deadDetector[ ch ] ) continue;
+
+			for ( int ib = 1; ib <= numTOTBins; ib++ )
+				correction[ ch ][ ib ] = c[ k * numTOTBins + ib - 1 ];
+
+			book->cd( "channel" + ts( ch ) );
+			TH1 * cor = book->get( iStr + "totcor" );
+			if ( !cor ){
+				book->make1D( iStr + "totcor", "Channel " + ts( ch + 1 ) + " Least Squares Correction;" + xLabel + ";" + yLabel, numTOTBins, totBins[ ch ] );
+				cor = book->get( iStr + "totcor" );
+			}
+			for ( int ib = 1; ib <= numTOTBins; ib++ ){
+				cor->SetBinContent( ib, correction[ ch ][ ib ] );
+				cor->SetBinError( ib, 0 );
+			}
+
+			if ( useSpline ){
+				// the smoothing fit weights each bin by its number of hits
+				vector<double> weights( numTOTBins );
+				for ( int ib = 1; ib <= numTOTBins; ib++ )
+					weights[ ib - 1 ] = directSides[ s ].hitCount( k * numTOTBins + ib - 1 );
+				if ( spline[ ch ] )
+					delete spline[ ch ];
+				spline[ ch ] = buildSpline( totBins[ ch ], &correction[ ch ][ 1 ], &weights[ 0 ], splineCoefficients[ ch ] );
+				splineWeights[ ch ] = weights;
+			}
+		}
+	}
+
+	cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] " << " completed in " << elapsed() << " seconds " << endl;
 }
 
 void calib::checkStep( ) {
@@ -1448,9 +2214,9 @@ void calib::checkStep( ) {
 	double avgCountWest = 0;
 	double neWest = 0;
 
-	Int_t nevents = (int)_chain->GetEntries();
+	Int_t nevents = (int)chainEntries();
 	for(Int_t i = 0; i < nevents; i++) {
-    	_chain->GetEntry(i);
+    	_chain->GetEntry( chainEntry( i ) );
 
 		progressBar( i, nevents, 75 );
 
@@ -1468,40 +2234,35 @@ void calib::checkStep( ) {
 		double sumWest = 0;
 		double countEast = 0;
 		double countWest = 0;
-		stringstream sstr;
 
-		for ( int j = constants::startWest; j < constants::endWest; j++ ){
+		// corrected times of the tubes with the tot in range
+		double t[ constants::nChannels ];
+		channelSet hits;
+		for ( int j : channelSet::all() ){
+		    double tot = getX( j );
+		    if( tot <= minTOT || tot > maxTOT) continue;
 
-			double tdcWest = getY( j );
-		    double totWest = getX( j );
-		  
-		    if( totWest <= minTOT || totWest > maxTOT) continue;
-		    
-		    double corWest = getCorrection( j, totWest ) +initialOffsets[ j ];
-		    tdcWest -= corWest;
+		    t[ j ] = getY( j ) - ( getCorrection( j, tot ) +initialOffsets[ j ] );
+		    hits.set( j );
+		}
 
-		    sumWest += tdcWest;
+		for ( int j : hits.west() ){
+		    sumWest += t[ j ];
 		    countWest++;
+		}
+		// the east sums were only made when the first west channel is in range
+		if ( hits.test( constants::startWest ) ){
+			for ( int k : hits.east() ){
+				sumEast += t[ k ];
+				countEast++;
+			}
+		}
 
-			for ( int k = constants::startEast; k < constants::endEast; k++ ){
-
-				double tdcEast = getY( k );
-		    	double totEast = getX( k );
-
-		    	if( totEast <= minTOT || totEast > maxTOT) continue;
-		    	
-		    	double corEast = getCorrection( k, totEast ) +initialOffsets[ k ];
-		    	tdcEast -= corEast;
-
-		    	if ( j == constants::startWest ){
-		    		sumEast += tdcEast;
-		    		countEast++;
-		    	}
+		for ( int j : hits.west() ){
+			for ( int k : hits.east() ){
 
 		    	// calculate the VPD z Vertex
-		    	double vpdZ = constants::c * ( tdcEast - tdcWest) / 2.0;
-		    	if ( doingTrigger() )
-		    		vpdZ = constants::c * ( tdcWest - tdcEast) / 2.0;
+		    	double vpdZ = vertexMatcher::vertex( t[ j ], t[ k ], doingTrigger() );
 
 		    	book->get( iStr+"all" )->Fill( tpcZ - vpdZ );
 		    	book->get( iStr+"zTPCzVPD" )->Fill( tpcZ, vpdZ );
@@ -1629,7 +2390,7 @@ void calib::finish( ){
 		book->cd( "final/fit" );
 
 		TH2D* tmp = (TH2D*)book->get( iStr + "cutAvgN", iCh );
-		tmp->FitSlicesY( g, 0, -1, avgNBackgroundCut );
+		fitSlices( tmp, g, avgNBackgroundCut );
 		TH1D* fsySig = (TH1D*)gDirectory->FindObject( (iStr + "cutAvgN" + "_2").c_str() );
 		TH1D* fsyMean = (TH1D*)gDirectory->FindObject( (iStr + "cutAvgN" + "_1").c_str() );
 		
@@ -1645,12 +2406,45 @@ void calib::finish( ){
 		//fr->SetParameter( 1, 0.05 )
 		//fr->SetParLimits( 1, 0.000001, 10 );
 
+		// closed form solution, same points as the chi2 fit in the fit range
+		resolutionFit wls;
+		for ( int ib = 1; ib <= sigFit->GetNbinsX(); ib++ ){
+			double n = sigFit->GetBinCenter( ib );
+			if ( n < 0 || n > 19 ) continue;
+			wls.add( n, sigFit->GetBinContent( ib ), sigFit->GetBinError( ib ) );
+		}
 
-		sigFit->Fit( "fr", "QR" );
+		double res = wls.parameter();
+		double resError = wls.parameterError();
+		double chiDoF = wls.chi2PerNdf();
 
-		cout << "Channel [ " << j << " ] Resolution: " << fr->GetParameter( 0 ) << " ns " << endl;
-		sigmas->SetBinContent( j + 1, fr->GetParameter( 0 ) );
-		sigmas->SetBinError( j + 1, fr->GetParError( 0 ) );
+		if ( "analytic" == resolutionFitMethod ){
+			// attach the result so that it is drawn with the histogram
+			fr->SetParameter( 0, res );
+			fr->SetParError( 0, resError );
+			sigFit->GetListOfFunctions()->Add( fr );
+		} else {
+			sigFit->Fit( "fr", "QR" );
+
+			double chi		 	= fr->GetChisquare();
+			float np			= fr->GetNumberFitPoints();
+			double mChiDoF = 0;
+			if (np>1){
+				mChiDoF	= chi/((Float_t)(np-1));
+			}
+
+			if ( "compare" == resolutionFitMethod ){
+				cout << "Channel [ " << j << " ] Resolution analytic - minuit : " << ( res - fr->GetParameter( 0 ) ) << " ns ( " << res << " +/- " << resError << " vs " << fr->GetParameter( 0 ) << " +/- " << fr->GetParError( 0 ) << " ), chi2/ndf " << chiDoF << " vs " << mChiDoF << endl;
+			}
+
+			res = fr->GetParameter( 0 );
+			resError = fr->GetParError( 0 );
+			chiDoF = mChiDoF;
+		}
+
+		cout << "Channel [ " << j << " ] Resolution: " << res << " ns " << endl;
+		sigmas->SetBinContent( j + 1, res );
+		sigmas->SetBinError( j + 1, resError );
 
 		double max = book->get( iCh + "sigmaFit" )->GetMaximum();
 
@@ -1663,14 +2457,7 @@ void calib::finish( ){
 										->draw();
 		book->style( iCh + "sigmaMean" )->set( "markerStyle", kCircle )->set( "draw", "same")
 										->draw( );
-		double chi		 	= fr->GetChisquare();
-		float np			= fr->GetNumberFitPoints();
-		double chiDoF = 0;
-		if (np>1){
-			chiDoF	= chi/((Float_t)(np-1));
-		}
-
-		text->DrawLatex(0.25,0.86, ("#sigma = " + ts( fr->GetParameter( 0 ) ) + " [ns] "  ).c_str() );
+		text->DrawLatex(0.25,0.86, ("#sigma = " + ts( res ) + " [ns] "  ).c_str() );
 		text->DrawLatex(0.25,0.81, ("#chi^{2}/DOF = " + ts( chiDoF) ).c_str() );
 
 		
@@ -1697,28 +2484,360 @@ void calib::finish( ){
 		->draw();
 
 	text->DrawLatex(0.25,0.25, ("Average #sigma = " + ts( avgFit->GetParameter( 0 ) ) + " [ns] ").c_str() );
+	finalResolution = avgFit->GetParameter( 0 );
 
 	report->savePage();	
 
 }
 
+/**
+ * Compares the corrections of this step with the ones it used and the vertex resolution
+ * with the one of the previous step.
+ * @param  previous the corrections before makeCorrections, numTOTBins + 1 values per channel
+ * @return          true if every change is below its threshold and at least minIterations steps are done
+ */
+bool calib::checkConvergence( const vector<double> &previous ){
+
+	string iStr = "it" + ts( currentIteration );
+
+	// largest per channel max and rms change of the bin corrections
+	double maxChange = 0, rmsChange = 0;
+	int maxChannel = -1;
+	for ( int k = constants::startWest; k < constants::endEast; k++ ){
+		if ( deadDetector[ k ] ) continue;
+		double m = 0, s2 = 0;
+		for ( int ib = 1; ib <= numTOTBins; ib++ ){
+			double d = correction[ k ][ ib ] - previous[ k * ( numTOTBins + 1 ) + ib ];
+			m = max( m, TMath::Abs( d ) );
+			s2 += d * d;
+		}
+		if ( m > maxChange ){
+			maxChange = m;
+			maxChannel = k;
+		}
+		rmsChange = max( rmsChange, sqrt( s2 / numTOTBins ) );
+	}
+
+	// rms of TPC - VPD vertex within the fit range of the step report
+	double vzCut = vzOutlierCut[ min( (size_t)cutLevel(), vzOutlierCut.size() - 1 ) ];
+	TH1 * hAvg = book->get( iStr + "avg", "OutlierRejection" );
+	double s0 = 0, s1 = 0, s2 = 0;
+	for ( int ib = 1; hAvg && ib <= hAvg->GetNbinsX(); ib++ ){
+		double x = hAvg->GetBinCenter( ib );
+		if ( x < -2 * vzCut || x > 2 * vzCut ) continue;
+		double w = hAvg->GetBinContent( ib );
+		s0 += w;
+		s1 += w * x;
+		s2 += w * x * x;
+	}
+	double vzResolution = s0 > 0 ? sqrt( max( s2 / s0 - ( s1 / s0 ) * ( s1 / s0 ), 0.0 ) ) : 0;
+	double vzChange = 1;
+	if ( lastVzResolution > 0 )
+		vzChange = ( lastVzResolution - vzResolution ) / lastVzResolution;
+	lastVzResolution = vzResolution;
+
+	cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] correction change max " << maxChange << " ns ( channel " << maxChannel << " ), rms " << rmsChange 
+		<< " ns, vz resolution " << vzResolution << " cm ( " << vzChange * 100 << "% better )" << endl;
+
+	if ( (int)currentIteration + 1 < minIterations )
+		return false;
+	return 	maxChange < convergeMaxChange && rmsChange < convergeRmsChange && vzChange < convergeVzChange;
+}
+
+/**
+ * Scores every combination of the cvSplineTypes and cvTOTBins on the held out fold of this step.
+ * The corrections of each candidate come from the training fold of the same step, so the
+ * scores of the last step compare the options at the converged reference times.
+ * Writes the table of scores to cvOutput, overwritten after every step.
+ */
+void calib::crossValidate( ){
+
+	vector<crossValidator::candidate> candidates = validator.score( cvSplineTypes, cvTOTBins, config.getAsBool( "variableBinning" ), splineSegments, splineSmoothing );
+	if ( candidates.empty() )
+		return;
+
+	// the candidates are only compared on the same channels
+	int nScored = 0;
+	for ( unsigned int i = 0; i < candidates.size(); i++ )
+		nScored = max( nScored, candidates[ i ].nScored );
+	int best = -1;
+	for ( unsigned int i = 0; i < candidates.size(); i++ ){
+		if ( candidates[ i ].nScored != nScored ) continue;
+		if ( best < 0 || candidates[ i ].width < candidates[ best ].width )
+			best = i;
+	}
+
+	string current = useSpline ? ( smoothSpline ? "pspline" : config.getAsString( "splineType", "akima" ) ) : "none";
+
+	string name = config.getAsString( "baseName" ) + config.getAsString( "cvOutput", "crossValidation.dat" );
+	ofstream f( name.c_str() );
+	f << "# step " << ( currentIteration + 1 ) << ", fold 1 of " << config.getAsInt( "crossValidationFolds", 0 ) << " held out" << endl;
+	f << "# splineType nBins width[ns] nChannels width of each channel[ns]" << endl;
+
+	cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] " << " Held out residual width of " << candidates.size() << " candidates" << endl;
+	for ( unsigned int i = 0; i < candidates.size(); i++ ){
+		const crossValidator::candidate &c = candidates[ i ];
+		f << c.splineType << " " << c.nBins << " " << c.width << " " << c.nScored;
+		for ( int ch = 0; ch < constants::nChannels; ch++ )
+			f << " " << c.channelWidth[ ch ];
+		f << endl;
+
+		bool isCurrent = ( current == c.splineType && numTOTBins == c.nBins );
+		cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] " << "    " << c.splineType << ", " << c.nBins << " bins : "
+			<< c.width << " ns ( " << c.nScored << " channels )" << ( (int)i == best ? " best" : "" ) << ( isCurrent ? " current" : "" ) << endl;
+	}
+
+	if ( best >= 0 ){
+		f << "# best : splineType " << candidates[ best ].splineType << " numTOTBins " << candidates[ best ].nBins << endl;
+		cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] " << " Best : splineType = " << candidates[ best ].splineType << ", numTOTBins = " << candidates[ best ].nBins << endl;
+	}
+	f << "# current : splineType " << current << " numTOTBins " << numTOTBins << endl;
+	f.close();
+}
+
+/**
+ * Plans the remaining steps from the time used so far and the cost of the last step.
+ * Prefers running the remaining steps on every event, otherwise runs the fewest steps allowed
+ * ( minIterations ) on the largest fraction that fits. The fraction is sampled within each run.
+ * Sets maxIterations and the eventFraction of the remaining steps.
+ * @return false if there is no time for another step
+ */
+bool calib::planBudget( ){
+
+	double used = wallTime() - jobStart;
+	// leave room for finish and the parameter files
+	double remaining = timeBudget * ( 1.0 - budgetReserve ) - used;
+	double perEvent = stepLoopSeconds / (double)max( stepEventsRead, 1L );
+	double perStep = stepSeconds - stepLoopSeconds;
+	double nAll = inMemory ? (double)storedEvents() : (double)chainEntries();
+
+	int maxSteps = (int)maxIterations - (int)currentIteration;
+	int minSteps = min( max( 1, minIterations - (int)currentIteration ), maxSteps );
+
+	int steps = 0;
+	double fraction = 0;
+	for ( int r = maxSteps; r >= minSteps && r > 0; r-- ){
+		fraction = ( remaining / r - perStep ) / ( perEvent * nAll );
+		steps = r;
+		if ( fraction >= 1 )
+			break;
+	}
+	fraction = min( fraction, 1.0 );
+
+	cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] " << used << " of " << timeBudget << " seconds used, " << perEvent * 1e6 << " us per event, " << perStep << " s per step" << endl;
+
+	// the schedule is done
+	if ( maxSteps <= 0 )
+		return false;
+
+	// too few events left to improve anything, a small sample only when not all of it fits
+	if ( steps <= 0 || fraction * nAll < min( 1000.0, nAll ) ){
+		cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] No time for another step" << endl;
+		maxIterations = currentIteration;
+		return false;
+	}
+
+	maxIterations = currentIteration + steps;
+	eventFraction.assign( maxIterations, fraction );
+
+	double worst = 0;
+	double precision = correctionPrecision( fraction / stepFraction, worst );
+	cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] " << steps << " more steps on " << fraction * 100 << "% of " << (long)nAll << " events, "
+		<< "estimated correction precision " << precision * 1000 << " ps ( worst channel " << worst * 1000 << " ps )" << endl;
+	return true;
+}
+
+/**
+ * Estimates the statistical precision of the bin corrections from the last step,
+ * the rms of the corrected times in a channel over the square root of the entries in each bin
+ * @param  scale number of events in the planned step relative to the last one
+ * @param  worst set to the precision of the worst channel
+ * @return       mean precision over the channels [ ns ]
+ */
+double calib::correctionPrecision( double scale, double &worst ){
+
+	string iStr = "it" + ts( currentIteration - 1 );
+	worst = 0;
+	double sum = 0;
+	int nChannels = 0;
+	for ( int k = constants::startWest; k < constants::endEast; k++ ){
+		if ( deadDetector[ k ] ) continue;
+		TH2 * h = (TH2*)book->get( iStr + "tdccor", "channel" + ts( k ) );
+		if ( !h ) continue;
+
+		double sigma = h->GetRMS( 2 );
+		double s = 0;
+		int nBins = 0;
+		for ( int ib = 1; ib <= h->GetNbinsX(); ib++ ){
+			double n = h->Integral( ib, ib, 1, h->GetNbinsY() ) * scale;
+			if ( n <= 0 ) continue;
+			s += sigma / sqrt( n );
+			nBins++;
+		}
+		if ( 0 == nBins ) continue;
+		sum += s / nBins;
+		worst = max( worst, s / nBins );
+		nChannels++;
+	}
+	return nChannels > 0 ? sum / nChannels : 0;
+}
+
+/**
+ * Summary page of the time budget : the steps and their sample sizes, the time used
+ * and the precision expected from the final sample
+ */
+void calib::budgetReport( ){
+
+	report->newPage();
+
+	TLatex * text = new TLatex();
+	text->SetNDC();
+	text->SetTextSize( 0.03 );
+
+	double nAll = inMemory ? (double)storedEvents() : (double)chainEntries();
+	double worst = 0;
+	// the last step used its own fraction so the scale is 1
+	double precision = correctionPrecision( 1.0, worst );
+
+	string fractions = "";
+	for ( unsigned int i = 0; i < stepFractions.size(); i++ )
+		fractions += ( i > 0 ? ", " : "" ) + ts( (int)TMath::Nint( stepFractions[ i ] * 100 ) ) + "%";
+
+	double y = 0.85;
+	text->DrawLatex( 0.1, y, ( "Time budget : " + ts( timeBudget ) + " s, used " + ts( wallTime() - jobStart ) + " s" ).c_str() ); y -= 0.06;
+	text->DrawLatex( 0.1, y, ( "Steps : " + ts( (int)stepFractions.size() ) + " ( " + fractions + " of the events )" ).c_str() ); y -= 0.06;
+	text->DrawLatex( 0.1, y, ( "Events in the last step : " + ts( (int)( stepFractions.empty() ? 0 : stepFractions.back() * nAll ) ) + " of " + ts( (int)nAll ) ).c_str() ); y -= 0.06;
+	text->DrawLatex( 0.1, y, ( "Correction precision : " + ts( precision * 1000 ) + " ps, worst channel " + ts( worst * 1000 ) + " ps" ).c_str() );
+
+	report->savePage();
+
+	cout << "[calib." << __FUNCTION__ << "] " << stepFractions.size() << " steps ( " << fractions << " ), correction precision " << precision * 1000 << " ps, worst channel " << worst * 1000 << " ps" << endl;
+}
+
 /**
  * Executes the given number of calibration steps and then
  * calls the finish() function to fit the single detector resolution.
  */
 void calib::loop( ) {
 
-	for ( unsigned int i = 0; i < maxIterations; i++ ){
-		step();
+	while ( loopStep() );
+	finishLoop();
+}
+
+/**
+ * Runs the next step of the calibration loop.
+ * Starts after the last completed step when resuming from a checkpoint.
+ * @return false once the loop is done, without running a step
+ */
+bool calib::loopStep( ) {
+
+	// one pass to solve for the corrections and one to refine them without the outliers
+	if ( directSolve ){
+		if ( currentIteration >= 2 )
+			return false;
+		// a resumed job may already have the solution
+		if ( 0 == currentIteration )
+			directPass();
+		else
+			step();
+		loopDone = currentIteration >= 2;
+		if ( writeCheckpoints )
+			writeCheckpoint();
+		return true;
 	}
+
+	if ( loopDone || currentIteration >= maxIterations )
+		return false;
+
+	step();
+	if ( stopOnConvergence && converged && stepFraction >= 1 ){
+		cout << "[calib." << __FUNCTION__ << "] Converged after " << currentIteration << " of " << maxIterations << " iterations" << endl;
+		loopDone = true;
+	} else if ( stopOnConvergence && converged && timeBudget <= 0 ){
+		// the resolution is fitted on the last step so it runs once more on every event
+		cout << "[calib." << __FUNCTION__ << "] Converged on " << stepFraction * 100 << "% of the events, one more step on all of them" << endl;
+		maxIterations = min( maxIterations, currentIteration + 1 );
+		eventFraction.assign( currentIteration + 1, 1.0 );
+	} else if ( timeBudget > 0 && !planBudget() )
+		loopDone = true;
+
+	// only the steps of the loop, a checkParams step must not replace the checkpoint of a calibration
+	if ( writeCheckpoints )
+		writeCheckpoint();
+	return true;
+}
+
+/**
+ * The final fits after the last step of the loop
+ */
+void calib::finishLoop( ) {
+
+	// the pages of the last step when the loop ended early
+	if ( currentIteration > 0 && drawnIteration != (int)currentIteration - 1 )
+		drawCorrections( currentIteration - 1 );
+
 	finish();
+	if ( timeBudget > 0 )
+		budgetReport();
+}
 
+
+/**
+ * The spline through the binned corrections of a channel.
+ * Interpolates the bin centers or, for pspline, fits a penalized B-spline to them.
+ * Does not touch ROOT objects other than the interpolator so it can run on the worker threads
+ * @param  edges        the tot bin edges, numTOTBins + 1 values
+ * @param  contents     the correction in each bin
+ * @param  weights      weight of each bin in the smoothing fit
+ * @param  coefficients set to the B-spline coefficients, empty unless a pspline was fitted
+ * @return              the new spline
+ */
+splineMaker * calib::buildSpline( const double * edges, const double * contents, const double * weights, vector<double> &coefficients ) const {
+
+	coefficients.clear();
+	if ( smoothSpline ){
+		vector<double> centers( numTOTBins );
+		for ( int ib = 0; ib < numTOTBins; ib++ )
+			centers[ ib ] = 0.5 * ( edges[ ib ] + edges[ ib + 1 ] );
+
+		pSpline p( edges[ 0 ], edges[ numTOTBins ], splineSegments, splineSmoothing );
+		if ( p.fit( &centers[ 0 ], contents, weights, numTOTBins ) ){
+			coefficients = p.coefficients();
+			return p.makeSpline();
+		}
+		// otherwise interpolate the bins
+	}
+
+	vector<double> x, y;
+	splineMaker::knotsFromBins( edges, contents, numTOTBins, splineAlignment::center, x, y );
+	return new splineMaker( x, y, splineType );
 }
 
+/**
+ * Inputs and results of the correction building for a single channel.
+ * Filled on the main thread, fitted and splined on the worker threads
+ */
+struct channelCorrection {
+	channelCorrection() : spline( NULL ), vSpline( NULL ) {}
+
+	// totcor profile, the weights are 1 / error^2 of each bin
+	vector<double> edges, corContents, corWeights;
+	// the coefficients of the spline if it is a pspline
+	vector<double> coefficients;
+
+	// slices of the pre and post correction slewing curves
+	sliceFitter::sliceInput pre, post;
+	sliceFitter::sliceResult preSlices, postSlices;
+
+	splineMaker * spline;
+	splineMaker * vSpline;
+};
 
 /**
  * After each calibration step the corrections are calculated from the slewing curves.
  * If Splines are used the spline is perpared and both the slewing curve and spline are drawn.
+ * The per channel slice estimation and spline building run on nThreads threads when 
+ * the built in slice estimator is used. Minuit fits and all drawing stay on the main thread.
  */
 void calib::makeCorrections( ){
 
@@ -1732,16 +2851,105 @@ void calib::makeCorrections( ){
 	// Bins with greater error on the fitslicesY mean will not be used in final correction
 	double maxError = config.getAsDouble( "binMaxError", 0.10);
 	
+	// range of the gaussian used for the slices
+	double gLo = -5, gHi = 5;
+	if ( !removeOffset ){
+		gLo = -10;
+		gHi = 10;
+	}
+
+	// Minuit is not thread safe so the slices can only be fitted in the workers with the estimator
+	bool fitInWorkers = ( sliceFitter::root != sliceMethod && !validateSlices );
+
+	vector<channelCorrection> work( constants::nChannels );
+
+	// average of the bootstrap spread over the profile error
+	double spreadRatio = 0;
+	int nSpreadRatio = 0;
+
+	// collect the inputs for each channel
+	for( int k = constants::startWest; k < constants::endEast; k++) {
+		if ( deadDetector[ k ] ) continue;
+
+		// switch into channel dir
+		book->cd( "channel" + ts( k ) );
+
+		// slewing curve without correction applied to channel k
+	    TH2D* pre = (TH2D*) book->get( iStr + "tdctot" );
+
+	    // slewing curve with correction applied to channel k
+	    TH2D* post = (TH2D*) book->get( iStr + "tdccor" );
+
+	    //TH1D* cor = (TH1D*) preMean->Clone( (iStr + "totcor").c_str() );
+	    TH1D* cor = (TH1D*) pre->ProfileX( (iStr + "totcor").c_str() );
+	    book->add( (iStr + "totcor").c_str(), cor  );
+
+	    channelCorrection &w = work[ k ];
+	    w.edges.resize( numTOTBins + 1 );
+	    w.corContents.resize( numTOTBins );
+	    w.corWeights.resize( numTOTBins );
+	    for ( int ib = 1; ib <= numTOTBins; ib++ ){
+	    	w.edges[ ib - 1 ] = cor->GetBinLowEdge( ib );
+	    	w.corContents[ ib - 1 ] = cor->GetBinContent( ib );
+	    	double e = cor->GetBinError( ib );
+	    	w.corWeights[ ib - 1 ] = e > 0 ? 1.0 / ( e * e ) : 0;
+	    }
+	    w.edges[ numTOTBins ] = cor->GetBinLowEdge( numTOTBins ) + cor->GetBinWidth( numTOTBins );
+
+	    // the spread of the replica profiles next to the profile
+	    if ( bootstrapReplicas > 0 ){
+	    	book->make1D( iStr + "totcorSpread", "Channel " + ts( k + 1 ) + " Bootstrap Spread of the Correction;" + xLabel + ";#sigma_{" + yLabel + "}", numTOTBins, totBins[ k ] );
+	    	TH1 * hSpread = book->get( iStr + "totcorSpread" );
+	    	correctionSpread[ k ].assign( numTOTBins, 0 );
+	    	for ( int ib = 1; ib <= numTOTBins; ib++ ){
+	    		correctionSpread[ k ][ ib - 1 ] = bootstrap[ k ].spread( ib - 1 );
+	    		hSpread->SetBinContent( ib, correctionSpread[ k ][ ib - 1 ] );
+	    		if ( cor->GetBinError( ib ) > 0 ){
+	    			spreadRatio += correctionSpread[ k ][ ib - 1 ] / cor->GetBinError( ib );
+	    			nSpreadRatio++;
+	    		}
+	    	}
+	    }
+
+	    if ( fitInWorkers ){
+	    	sliceFitter::snapshot( pre, w.pre );
+	    	sliceFitter::snapshot( post, w.post );
+	    }
+	}
+
+	if ( nSpreadRatio > 0 )
+		cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] " << " Bootstrap spread / profile error : " << spreadRatio / nSpreadRatio << " on average ( " << bootstrapReplicas << " replicas )" << endl;
+
+	// fit and build the splines concurrently
+	jdbUtils::parallelFor( constants::nChannels, nThreads, [&]( int k ){
+		if ( deadDetector[ k ] ) return;
+		channelCorrection &w = work[ k ];
+
+		vector<double> x, y;
+		if ( useSpline )
+			w.spline = buildSpline( &w.edges[ 0 ], &w.corContents[ 0 ], &w.corWeights[ 0 ], w.coefficients );
+
+		if ( fitInWorkers ){
+			sliceFitter::estimateSlices( sliceMethod, w.pre, gLo, gHi, 0, w.preSlices );
+			sliceFitter::estimateSlices( sliceMethod, w.post, gLo, gHi, 0, w.postSlices );
+
+			// make a spline for drawing, bins without an estimate are zero as in the histogram
+			vector<double> dif( numTOTBins, 0 );
+			for ( int ib = 0; ib < numTOTBins && ib < (int)w.postSlices.valid.size(); ib++ ){
+				if ( w.postSlices.valid[ ib ] )
+					dif[ ib ] = w.postSlices.mean[ ib ];
+			}
+			splineMaker::knotsFromBins( &w.edges[ 0 ], &dif[ 0 ], numTOTBins, splineAlignment::center, x, y );
+			w.vSpline = new splineMaker( x, y, splineType );
+		}
+	});
 	
 	report->newPage( 4, 5);
 
-	// get the corrections for the next iteration 
+	// store the results and draw them
 	for( int k = constants::startWest; k < constants::endEast; k++) {
 		if ( deadDetector[ k ] ) continue;
-
-		TF1* g = new TF1( "g", "gaus", -5, 5 );
-		if ( !removeOffset )
-			g->SetRange( -10, 10 );
+		channelCorrection &w = work[ k ];
 
 		if ( currentIteration <= 1 || currentIteration == maxIterations - 1){
 			if ( deadDetector[ k ] ){
@@ -1759,40 +2967,33 @@ void calib::makeCorrections( ){
 		// switch into channel dir
 		book->cd( "channel" + ts( k ) );
 
-		// slewing curve without correction applied to channel k
 	    TH2D* pre = (TH2D*) book->get( iStr + "tdctot" );
-
-	    // slewing curve with correction applied to channel k
 	    TH2D* post = (TH2D*) book->get( iStr + "tdccor" );
 
 		book->cd( "channel" + ts( k ) + "/fit" );
 
-		// do the fit
-	    pre->FitSlicesY( g );
-
-
+		if ( fitInWorkers ){
+			sliceFitter::makeHistograms( pre, w.preSlices );
+			sliceFitter::makeHistograms( post, w.postSlices );
+		} else {
+			TF1* g = new TF1( "g", "gaus", gLo, gHi );
 
-	    TH1D* preMean = (TH1D*) gDirectory->FindObject( 
-	    					(iStr + "tdctot_1").c_str() );
+			// do the fit
+		    fitSlices( pre, g );
 
-	    // do the fit
-	    post->FitSlicesY( g );
-	    delete g;
+		    // do the fit
+		    fitSlices( post, g );
+		    delete g;
+		}
 
 	    TH1D* postMean = (TH1D*) gDirectory->FindObject( 
 	    					(iStr + "tdccor_1").c_str() );
 
 	    book->cd( "channel" + ts( k ) );
 
-	    //TH1D* cor = (TH1D*) preMean->Clone( (iStr + "totcor").c_str() );
-	    TH1D* cor = (TH1D*) pre->ProfileX( (iStr + "totcor").c_str() );
-	    book->add( (iStr + "totcor").c_str(), cor  );
-
 	    TH1D* dif = (TH1D*) postMean->Clone( (iStr + "difcor").c_str() );
 	    book->add( ("it" + ts( currentIteration ) + "difcor").c_str(), dif  );
 
-	    double reset = 0;
-	    
 	    for ( int ib = 1; ib <= numTOTBins ; ib ++ ){
 
 	    	/*if ( removeOffset ){
@@ -1811,54 +3012,35 @@ void calib::makeCorrections( ){
 	    		dif->SetBinContent( ib, 0 );
 	    	}*/
 
-	    	correction[ k ][ ib  ] = cor->GetBinContent( ib );
+	    	correction[ k ][ ib  ] = w.corContents[ ib - 1 ];
 	    	
 	    }
 
 
 	    if ( spline[ k ])
 	    	delete spline[ k ];
-	    
-	    if ( useSpline )
-		    spline[ k ] = new splineMaker( cor, splineAlignment::center, splineType );
+	    spline[ k ] = w.spline;
+	    splineCoefficients[ k ] = w.coefficients;
+	    splineWeights[ k ] = w.corWeights;
 
 		// make a spline for drawing
-		splineMaker* vSpline;
-		vSpline = new splineMaker( dif, splineAlignment::center, splineType );
+		splineMaker* vSpline = w.vSpline;
+		if ( !vSpline )
+			vSpline = new splineMaker( dif, splineAlignment::center, splineType );
 	    
 	    if ( currentIteration <= 1 || currentIteration == maxIterations - 1){
 		    
-		    if ( removeOffset )
-		    	book->style( ("it"+ts(currentIteration)+"tdccor") )->set( "range", -5.0, 5.0);
-		    else{
-		    	//book->style( ("it"+ts(currentIteration)+"tdccor") )->set( "dynamicdomain", 1, -1, -1, 2 );
-		    	book->style( ("it"+ts(currentIteration)+"tdccor") )->set( "range", -15.0, 15.0);
-		    }
-		    	
-		    if ( xVariable.find( "adc" ) != string::npos )
-		    	book->style( ("it"+ts(currentIteration)+"tdccor") )->set( "numberOfTicks", 5, 5);
-
-		    post->Draw( "colz" );
-
-		    if ( doingTrigger() )
-			    gPad->SetLogx(1);
-		    
-		    if ( useSpline ){
-		    	TGraph* g = vSpline->graph( minTOT, maxTOT, (maxTOT - minTOT) / 50.0 );
-		    	g->GetYaxis()->SetRangeUser( -5, 5);
-		    	g->SetMarkerStyle(7);
-		    	g->SetMarkerColor( kRed );
-		    	g->Draw( "same cp" );
-			}
+		    drawCorrection( currentIteration, post, vSpline );
 			
 		    if ( k == constants::endEast - 1 || k == constants::endWest - 1){
 		    	report->savePage();
 		    	report->newPage( 4, 5);
 	    	}
-
-	    	// delete the spline for drawing
-			delete vSpline;
+	    	drawnIteration = currentIteration;
     	}
+
+    	// delete the spline for drawing
+		delete vSpline;
 	    
 
 	}
@@ -1866,6 +3048,169 @@ void calib::makeCorrections( ){
 	cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] " << " completed in " << elapsed() << " seconds " << endl;
 }
 
+/**
+ * Draws the corrected times of a channel after a step with the spline through their means
+ * @param iteration the step
+ * @param post      the tdccor histogram of the channel
+ * @param vSpline   spline through the means of the slices of post
+ */
+void calib::drawCorrection( int iteration, TH2D * post, splineMaker * vSpline ){
+
+	string iStr = "it" + ts( iteration );
+    if ( config.getAsBool( "removeOffset" ) )
+    	book->style( iStr + "tdccor" )->set( "range", -5.0, 5.0);
+    else{
+    	//book->style( iStr + "tdccor" )->set( "dynamicdomain", 1, -1, -1, 2 );
+    	book->style( iStr + "tdccor" )->set( "range", -15.0, 15.0);
+    }
+    	
+    if ( xVariable.find( "adc" ) != string::npos )
+    	book->style( iStr + "tdccor" )->set( "numberOfTicks", 5, 5);
+
+    post->Draw( "colz" );
+
+    if ( doingTrigger() )
+	    gPad->SetLogx(1);
+    
+    if ( useSpline && vSpline ){
+    	TGraph* g = vSpline->graph( minTOT, maxTOT, (maxTOT - minTOT) / 50.0 );
+    	g->GetYaxis()->SetRangeUser( -5, 5);
+    	g->SetMarkerStyle(7);
+    	g->SetMarkerColor( kRed );
+    	g->Draw( "same cp" );
+	}
+}
+
+/**
+ * Draws the correction pages of a step from its histograms, for the last step of a loop that
+ * ended before maxIterations ( convergence or time budget ) and so was not drawn by makeCorrections
+ * @param iteration the step
+ */
+void calib::drawCorrections( int iteration ){
+
+	string iStr = "it" + ts( iteration );
+	report->newPage( 4, 5);
+	for( int k = constants::startWest; k < constants::endEast; k++) {
+		if ( k != constants::startWest && k != constants::startEast )
+			report->next();
+
+		book->cd( "channel" + ts( k ) );
+		TH2D* post = (TH2D*) book->get( iStr + "tdccor" );
+		TH1D* dif = (TH1D*) book->get( iStr + "difcor" );
+		if ( !deadDetector[ k ] && post && dif ){
+			splineMaker vSpline( dif, splineAlignment::center, splineType );
+			drawCorrection( iteration, post, &vSpline );
+		}
+
+	    if ( k == constants::endEast - 1 || k == constants::endWest - 1){
+	    	report->savePage();
+	    	report->newPage( 4, 5);
+    	}
+	}
+	drawnIteration = iteration;
+}
+
+/**
+ * Extracts the gaussian mean and sigma of each x bin of h.
+ * Uses TH2::FitSlicesY or the sliceFitter estimator according to the sliceFit option.
+ * In validation mode both are run, the configured result keeps the standard names
+ * and the per bin differences ( estimator - FitSlicesY ) are stored as <name>_dMean, <name>_dSigma
+ * @param h   The 2D histogram to slice
+ * @param g   The gaussian used by FitSlicesY, its range is used by the estimator as well
+ * @param cut Slices with fewer entries are skipped
+ */
+void calib::fitSlices( TH2D * h, TF1 * g, int cut ){
+
+	if ( !h || !g )
+		return;
+
+	double lo = 0, hi = 0;
+	g->GetRange( lo, hi );
+
+	if ( !validateSlices ){
+		if ( sliceFitter::root == sliceMethod )
+			h->FitSlicesY( g, 0, -1, cut );
+		else 
+			sliceFitter::fitSlicesY( h, sliceMethod, lo, hi, cut );
+		return;
+	}
+
+	string name = h->GetName();
+	string rootName = name;
+	string fastName = name + "Fast";
+	int method = sliceMethod;
+	if ( sliceFitter::root == method )
+		method = sliceFitter::truncated;
+
+	h->FitSlicesY( g, 0, -1, cut );
+
+	// the configured estimator keeps the standard names used by the caller
+	if ( sliceFitter::root != sliceMethod ){
+		rootName = name + "Root";
+		fastName = name;
+		for ( int p = 1; p <= 2; p++ ){
+			string from = name + "_" + ts( p );
+			string to = rootName + "_" + ts( p );
+			TObject * old = gDirectory->FindObject( to.c_str() );
+			if ( old )
+				delete old;
+			TH1D * fsy = (TH1D*)gDirectory->FindObject( from.c_str() );
+			if ( fsy )
+				fsy->SetName( to.c_str() );
+		}
+	}
+	sliceFitter::fitSlicesY( h, method, lo, hi, cut, fastName );
+
+	TH1D * rMean = (TH1D*)gDirectory->FindObject( (rootName + "_1").c_str() );
+	TH1D * rSigma = (TH1D*)gDirectory->FindObject( (rootName + "_2").c_str() );
+	TH1D * fMean = (TH1D*)gDirectory->FindObject( (fastName + "_1").c_str() );
+	TH1D * fSigma = (TH1D*)gDirectory->FindObject( (fastName + "_2").c_str() );
+	if ( !rMean || !rSigma || !fMean || !fSigma )
+		return;
+
+	TH1D * dMean = NULL, * dSigma = NULL;
+	string dNames[ 2 ] = { name + "_dMean", name + "_dSigma" };
+	for ( int p = 0; p < 2; p++ ){
+		TObject * old = gDirectory->FindObject( dNames[ p ].c_str() );
+		if ( old )
+			delete old;
+	}
+	dMean = (TH1D*)rMean->Clone( dNames[ 0 ].c_str() );
+	dMean->Reset();
+	dMean->SetTitle( "estimator - FitSlicesY : mean" );
+	dSigma = (TH1D*)rSigma->Clone( dNames[ 1 ].c_str() );
+	dSigma->Reset();
+	dSigma->SetTitle( "estimator - FitSlicesY : sigma" );
+
+	int nCompared = 0;
+	double maxDMean = 0, maxDSigma = 0, sumPull2 = 0;
+	for ( int ib = 1; ib <= rMean->GetNbinsX(); ib++ ){
+		// only compare bins where both gave a result
+		if ( 0 == rMean->GetBinError( ib ) || 0 == fMean->GetBinError( ib ) ) continue;
+
+		double dm = fMean->GetBinContent( ib ) - rMean->GetBinContent( ib );
+		double ds = fSigma->GetBinContent( ib ) - rSigma->GetBinContent( ib );
+		dMean->SetBinContent( ib, dm );
+		dMean->SetBinError( ib, rMean->GetBinError( ib ) );
+		dSigma->SetBinContent( ib, ds );
+		dSigma->SetBinError( ib, rSigma->GetBinError( ib ) );
+
+		double pull = dm / rMean->GetBinError( ib );
+		sumPull2 += pull * pull;
+		nCompared++;
+		maxDMean = max( maxDMean, TMath::Abs( dm ) );
+		maxDSigma = max( maxDSigma, TMath::Abs( ds ) );
+
+		if ( TMath::Abs( pull ) > 1.0 ){
+			cout << "[calib." << __FUNCTION__ << "] " << name << " bin " << ib << " : dMean = " << dm << " ( " << pull << " sigma ), dSigma = " << ds << endl;
+		}
+	}
+
+	if ( nCompared > 0 ){
+		cout << "[calib." << __FUNCTION__ << "] " << name << " " << sliceFitter::methodName( method ) << " vs FitSlicesY : " << nCompared << " bins, max |dMean| = " << maxDMean << " ns, max |dSigma| = " << maxDSigma << " ns, rms pull = " << TMath::Sqrt( sumPull2 / nCompared ) << endl;
+	}
+}
+
 /**
  * Outputs the slewing curve corrections in DB format
  * Adds the offsets back as well as the channel 1 relative offset
@@ -1908,16 +3253,22 @@ void calib::writeParameters(  ){
 			f << totBins[ j ][ i ] << " ";
 		}
 		f << endl;
-		for ( int i = 0; i <= numTOTBins; i++ ){
-			double totStep = (( maxTOT - minTOT ) / (double)(numTOTBins));
-			double tot = minTOT + totStep * (double)(i);
 
+		// the points where the spline is evaluated, all evaluated at once
+		vector<double> tots( numTOTBins + 1 ), splineCors( numTOTBins + 1, 0 );
+		for ( int i = 0; i <= numTOTBins; i++ ){
 			if ( 0 == i )
-				tot = minTOT;
+				tots[ i ] = minTOT;
 			else if ( numTOTBins == i )
-				tot = maxTOT;
+				tots[ i ] = maxTOT;
 			else
-				tot = (totBins[ j ][ i ] + totBins[ j ][ i + 1 ] ) / 2.0;
+				tots[ i ] = (totBins[ j ][ i ] + totBins[ j ][ i + 1 ] ) / 2.0;
+		}
+		if ( !deadDetector[ j ] && spline[ j ] )
+			spline[ j ]->eval( &tots[ 0 ], &splineCors[ 0 ], numTOTBins + 1 );
+
+		for ( int i = 0; i <= numTOTBins; i++ ){
+			double tot = tots[ i ];
 
 			double off = 0;
 			if ( removeOffset ){
@@ -1940,7 +3291,7 @@ void calib::writeParameters(  ){
 			// spline based corrections
 			double sCor = 0;
 			if ( !deadDetector[ j ] )
-				sCor = spline[ j ]->eval( tot ) + off;
+				sCor = splineCors[ i ] + off;
 
 			book->get( "splineSlewingCor" +ts(j) )->SetBinContent( 
 				book->get( "splineSlewingCor" +ts(j) )->GetXaxis()->FindBin( tot ), sCor );
@@ -1958,6 +3309,34 @@ void calib::writeParameters(  ){
 
 	f.close();
 
+	// the compact form of the smoothing splines
+	if ( smoothSpline ){
+		string cName = config.getAsString( "baseName" ) + config.getAsString( "splineCoefficientsOutput", "splineCoefficients.dat" );
+		ofstream cf( cName.c_str() );
+		for ( int j = constants::startWest; j < constants::endEast; j++ ){
+
+			// the B-splines sum to one so the offset is added to every coefficient
+			double off = 0;
+			if ( removeOffset )
+				off = initialOffsets[ j ] - finalWestOffset;
+			else if ( j >= constants::startEast && j < constants::endEast )
+				off = 0 - eastWestOffset;
+
+			const vector<double> &coef = splineCoefficients[ j ];
+			int nSegments = ( deadDetector[ j ] || coef.size() < 4 ) ? 0 : (int)coef.size() - 3;
+			cf << ( j + 1 ) << endl;
+			cf << nSegments << " " << totBins[ j ][ 0 ] << " " << totBins[ j ][ numTOTBins ] << endl;
+			for ( int i = 0; i < nSegments + 3 && nSegments > 0; i++ )
+				cf << ( coef[ i ] + off ) << " ";
+			cf << endl;
+		}
+		cf.close();
+		cout << "[calib." << __FUNCTION__ << "] " << " spline coefficients written to " << cName << endl;
+	}
+
+	if ( bootstrapReplicas > 0 )
+		writeSpreads();
+
 
 	//draw the parameters
 	report->newPage( 3, 4 );
@@ -1987,6 +3366,436 @@ void calib::writeParameters(  ){
 }
 
 
+/**
+ * Follows the offset of every channel through the data in run order.
+ * The offset of a channel is its time relative to the reference channel, for the east channels
+ * less the vertex term 2 z_TPC / c, and is estimated by the median of a sliding window of
+ * its last driftWindow hits ( or its hits in the last driftWindowRuns runs ). The window is updated
+ * one hit at a time ( see slidingMedian ) instead of being recomputed.
+ * After every run the medians are written to driftOutput. A channel whose median moved by more than
+ * driftThreshold since the start or its last jump is listed in driftJumpsOutput.
+ */
+void calib::trackDrift( ){
+
+	cout << "[calib." << __FUNCTION__ << "] " << " Start " << endl;
+	startTimer();
+
+	long window = config.getAsInt( "driftWindow", 20000 );
+	int windowRuns = config.getAsInt( "driftWindowRuns", 0 );
+	long minHits = config.getAsInt( "driftMinHits", 1000 );
+	double threshold = config.getAsDouble( "driftThreshold", 0.1 );
+
+	// the entries of each run in run order, the scan uses its own branch addresses
+	runGroups scan( _chain, config );
+	scan.scan();
+	attachChain();
+	const map< int, vector< pair< Long64_t, Long64_t > > > &runs = scan.runs();
+
+	slidingMedian median[ constants::nChannels ];
+	// the values in the window in the order they were added and the hits of each run in it
+	deque<double> values[ constants::nChannels ];
+	deque<long> runHits[ constants::nChannels ];
+	double baseline[ constants::nChannels ];
+	bool hasBaseline[ constants::nChannels ];
+	for ( int j = 0; j < constants::nChannels; j++ )
+		hasBaseline[ j ] = false;
+
+	string oName = config.getAsString( "baseName" ) + config.getAsString( "driftOutput", "drift.dat" );
+	string jName = config.getAsString( "baseName" ) + config.getAsString( "driftJumpsOutput", "driftJumps.dat" );
+	ofstream out( oName.c_str() );
+	ofstream jumps( jName.c_str() );
+	out << "# run events offset of channels 1 - " << constants::nChannels << " [ns], 0 with fewer than " << minHits << " hits in the window" << endl;
+	jumps << "# run channel before[ns] after[ns] shift[ns]" << endl;
+
+	// vpdZ = c ( tEast - tWest ) / 2, the other way around for the trigger times
+	double zSign = doingTrigger() ? -1 : 1;
+	int nJumps = 0;
+	int iRun = 0;
+	for ( map< int, vector< pair< Long64_t, Long64_t > > >::const_iterator it = runs.begin(); it != runs.end(); ++it, iRun++ ){
+		progressBar( iRun, (int)runs.size(), 75 );
+
+		int run = it->first;
+		if ( !runInRange( run ) ) continue;
+
+		long hitsInRun[ constants::nChannels ] = { 0 };
+		long events = 0;
+		for ( unsigned int r = 0; r < it->second.size(); r++ ){
+			for ( Long64_t e = it->second[ r ].first; e < it->second[ r ].second; e++ ){
+				_chain->GetEntry( e );
+				if ( !passEventCuts() ) continue;
+				events++;
+
+				double reference = getY( refChannel );
+				if ( 0 == reference ) continue;
+
+				for ( int j : ~deadDetector ){
+					if ( (int)refChannel == j || pico->numHits( j ) < constants::minHits ) continue;
+
+					double tdc = getY( j );
+					double tot = getX( j );
+					if ( doingTrigger() && minTriggerTDC > tdc ) continue;
+					if ( !doingTrigger() && ( tot <= minTOT || tot >= maxTOT ) ) continue;
+
+					double d = tdc - reference;
+					if ( j >= constants::startEast && j < constants::endEast )
+						d -= zSign * 2.0 * pico->vertexZ / constants::c;
+
+					median[ j ].add( d );
+					values[ j ].push_back( d );
+					hitsInRun[ j ]++;
+
+					// a window of hits drops the oldest one
+					if ( windowRuns <= 0 && (long)values[ j ].size() > window ){
+						median[ j ].remove( values[ j ].front() );
+						values[ j ].pop_front();
+					}
+				}
+			}
+		}
+
+		// a window of runs drops the hits of the oldest run
+		for ( int j = 0; j < constants::nChannels && windowRuns > 0; j++ ){
+			runHits[ j ].push_back( hitsInRun[ j ] );
+			while ( (int)runHits[ j ].size() > windowRuns ){
+				for ( long k = 0; k < runHits[ j ].front(); k++ ){
+					median[ j ].remove( values[ j ].front() );
+					values[ j ].pop_front();
+				}
+				runHits[ j ].pop_front();
+			}
+		}
+
+		out << run << " " << events;
+		int nMoved = 0;
+		for ( int j = 0; j < constants::nChannels; j++ ){
+			double m = 0;
+			if ( median[ j ].size() >= minHits ){
+				m = median[ j ].median();
+				if ( !hasBaseline[ j ] ){
+					baseline[ j ] = m;
+					hasBaseline[ j ] = true;
+				} else if ( TMath::Abs( m - baseline[ j ] ) > threshold ){
+					jumps << run << " " << ( j + 1 ) << " " << baseline[ j ] << " " << m << " " << ( m - baseline[ j ] ) << endl;
+					cout << "[calib." << __FUNCTION__ << "] Run " << run << " : Channel " << ( j + 1 ) << " offset moved by " << ( m - baseline[ j ] ) << " ns" << endl;
+					baseline[ j ] = m;
+					nMoved++;
+					nJumps++;
+				}
+			}
+			out << " " << m;
+		}
+		out << endl;
+
+		if ( nMoved > constants::nChannels / 2 )
+			cout << "[calib." << __FUNCTION__ << "] Run " << run << " : " << nMoved << " channels moved together, most likely the reference channel " << ( refChannel + 1 ) << " did" << endl;
+	}
+	out.close();
+	jumps.close();
+
+	cout << "[calib." << __FUNCTION__ << "] " << nJumps << " offset jumps in " << runs.size() << " runs, written to " << oName << " and " << jName << endl;
+	cout << "[calib." << __FUNCTION__ << "] " << " completed in " << elapsed() << " seconds " << endl;
+}
+
+/**
+ * Writes the bootstrap spread of the corrections in the layout of the parameter file.
+ * Each correction is replaced by the spread of the replica corrections of its tot bin,
+ * the points at minTOT and maxTOT use the first and last bin.
+ */
+void calib::writeSpreads(  ){
+
+	string sName = config.getAsString( "baseName" ) + config.getAsString( "bootstrapOutput", "paramsSpread.dat" );
+	ofstream f( sName.c_str() );
+
+	for ( int j = constants::startWest; j < constants::endEast; j++ ){
+		f << (j + 1) << endl;
+		f << (numTOTBins) << endl;
+		for ( int i = 0; i <= numTOTBins; i++ )
+			f << totBins[ j ][ i ] << " ";
+		f << endl;
+
+		const vector<double> &s = correctionSpread[ j ];
+		for ( int i = 0; i <= numTOTBins; i++ ){
+			int ib = i < numTOTBins ? i : numTOTBins - 1;
+			f << ( ( !deadDetector[ j ] && ib < (int)s.size() ) ? s[ ib ] : 0 ) << " ";
+		}
+		f << endl;
+	}
+	f.close();
+
+	cout << "[calib." << __FUNCTION__ << "] " << " bootstrap spreads of " << bootstrapReplicas << " replicas written to " << sName << endl;
+}
+
+/**
+ * Writes everything the following steps need to a checkpoint file : the iteration, the tot binning,
+ * the dead channels, the offsets, the correction tables and the inputs of the splines.
+ * Written to a temporary file that is then renamed so that a job killed while writing
+ * leaves the previous checkpoint intact.
+ */
+void calib::writeCheckpoint(  ){
+
+	// the readiness of the step that follows, the step just finished filled its totcor histograms
+	updateTotBins();
+
+	string tmpName = checkpointName + ".tmp";
+	ofstream f( tmpName.c_str() );
+	if ( !f.is_open() ){
+		cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] Cannot write " << tmpName << endl;
+		return;
+	}
+	f << setprecision( 17 );
+
+	f << "# vpd calibration checkpoint" << endl;
+	f << "version " << checkpointVersion << endl;
+	f << "iteration " << currentIteration << " " << numTOTBins << endl;
+	f << "offsets " << eastWestOffset << " " << finalWestOffset << " " << lastVzResolution << endl;
+	// the schedule that is running, it can differ from the config's after a failed warm start or with a time budget
+	bool finished = loopDone || ( !directSolve && currentIteration >= maxIterations );
+	f << "finished " << ( finished ? 1 : 0 ) << endl;
+	f << "schedule " << cutOffset << " " << maxIterations << " " << eventFraction.size();
+	for ( unsigned int i = 0; i < eventFraction.size(); i++ )
+		f << " " << eventFraction[ i ];
+	f << endl;
+
+	for ( int j = 0; j < constants::nChannels; j++ ){
+		f << "channel " << j << " " << ( deadDetector[ j ] ? 1 : 0 ) << " " << ( totBinsReady[ j ] ? 1 : 0 ) << " "
+			<< initialOffsets[ j ] << " " << outlierOffsets[ j ] << endl;
+		for ( int k = 0; k <= numTOTBins; k++ )
+			f << totBins[ j ][ k ] << " ";
+		f << endl;
+		for ( int k = 0; k <= numTOTBins; k++ )
+			f << correction[ j ][ k ] << " ";
+		f << endl;
+		f << splineWeights[ j ].size();
+		for ( unsigned int k = 0; k < splineWeights[ j ].size(); k++ )
+			f << " " << splineWeights[ j ][ k ];
+		f << endl;
+	}
+	f.close();
+
+	if ( f.fail() || 0 != rename( tmpName.c_str(), checkpointName.c_str() ) ){
+		cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] Cannot write " << checkpointName << endl;
+		return;
+	}
+	cout << "[calib." << __FUNCTION__ << "[" << currentIteration << "]] " << " Checkpoint written to " << checkpointName << endl;
+}
+
+/**
+ * Restores the state written by writeCheckpoint so that loop continues with the next step.
+ * The splines are rebuilt from the restored corrections and their weights.
+ * A checkpoint of a finished job is refused, its step cannot be run again without adding an iteration.
+ * @return false if the checkpoint is missing or does not match the configuration
+ */
+bool calib::readCheckpoint(  ){
+
+	cout << "[calib." << __FUNCTION__ << "] " << " Reading " << checkpointName << endl;
+
+	ifstream f( checkpointName.c_str() );
+	if ( !f.is_open() ){
+		cout << "[calib." << __FUNCTION__ << "] Cannot open " << checkpointName << endl;
+		return false;
+	}
+
+	string line, key;
+	getline( f, line );
+
+	int version = 0, iteration = 0, nBins = 0;
+	f >> key >> version;
+	if ( "version" != key || checkpointVersion != version ){
+		cout << "[calib." << __FUNCTION__ << "] Unknown checkpoint version" << endl;
+		return false;
+	}
+	f >> key >> iteration >> nBins;
+	if ( nBins != numTOTBins ){
+		cout << "[calib." << __FUNCTION__ << "] Checkpoint has " << nBins << " tot bins, config has " << numTOTBins << endl;
+		return false;
+	}
+	f >> key >> eastWestOffset >> finalWestOffset >> lastVzResolution;
+
+	// the parameters of a finished job are written, running a step again would add an iteration
+	int finished = 0;
+	f >> key >> finished;
+	if ( "finished" != key || 1 == finished ){
+		cout << "[calib." << __FUNCTION__ << "] The checkpoint is of a finished job, run the calibration again or use its parameters" << endl;
+		return false;
+	}
+
+	int offset = 0;
+	unsigned int nSteps = 0, nFractions = 0;
+	f >> key >> offset >> nSteps >> nFractions;
+	vector<double> fractions( nFractions, 1.0 );
+	for ( unsigned int i = 0; i < nFractions; i++ )
+		f >> fractions[ i ];
+	if ( "schedule" != key || fractions.empty() ){
+		cout << "[calib." << __FUNCTION__ << "] Checkpoint has no schedule" << endl;
+		return false;
+	}
+	cutOffset = offset;
+	maxIterations = nSteps;
+	eventFraction = fractions;
+
+	deadDetector.clear();
+	for ( int j = 0; j < constants::nChannels; j++ ){
+		int channel = 0, dead = 0, ready = 0;
+		f >> key >> channel >> dead >> ready >> initialOffsets[ j ] >> outlierOffsets[ j ];
+		if ( "channel" != key || channel != j ){
+			cout << "[calib." << __FUNCTION__ << "] Checkpoint is truncated at channel " << j << endl;
+			return false;
+		}
+		deadDetector.set( j, 1 == dead );
+		resumeTotBinsReady[ j ] = ( 1 == ready );
+
+		for ( int k = 0; k <= numTOTBins; k++ )
+			f >> totBins[ j ][ k ];
+		for ( int k = 0; k <= numTOTBins; k++ )
+			f >> correction[ j ][ k ];
+		unsigned int nWeights = 0;
+		f >> nWeights;
+		splineWeights[ j ].resize( nWeights );
+		for ( unsigned int k = 0; k < nWeights; k++ )
+			f >> splineWeights[ j ][ k ];
+	}
+	if ( f.fail() ){
+		cout << "[calib." << __FUNCTION__ << "] Cannot read " << checkpointName << endl;
+		return false;
+	}
+
+	// rebuild the splines of the restored corrections
+	for ( int j = constants::startWest; j < constants::endEast; j++ ){
+		if ( spline[ j ] )
+			delete spline[ j ];
+		spline[ j ] = NULL;
+		if ( !useSpline || deadDetector[ j ] ) continue;
+
+		if ( (int)splineWeights[ j ].size() != numTOTBins )
+			splineWeights[ j ].assign( numTOTBins, 1.0 );
+		spline[ j ] = buildSpline( totBins[ j ], &correction[ j ][ 1 ], &splineWeights[ j ][ 0 ], splineCoefficients[ j ] );
+	}
+
+	currentIteration = iteration;
+	resumeIteration = iteration;
+	totBinsIteration = -1;
+
+	cout << "[calib." << __FUNCTION__ << "] " << " Resuming at step " << currentIteration + 1 << " of " << maxIterations << endl;
+	return true;
+}
+
+/**
+ * Starts the calibration from the corrections of an earlier parameter file ( see writeParameters ) instead of zero.
+ * Each channel's tot bins are taken from the file and its corrections are the file's values less the
+ * offsets implied by this job's initial offsets, so it needs to run after binTOT and offsets.
+ * Channels that are dead in this job or in the file start from zero as usual.
+ * The cut schedules start at warmStartCutLevel and the loop runs warmStartIterations steps, see the constructor.
+ * @return false without a warmStart file or if it cannot be used
+ */
+bool calib::warmStart( ){
+
+	if ( "" == warmStartName )
+		return false;
+
+	if ( doingTrigger() ){
+		cout << "[calib." << __FUNCTION__ << "] The warm start only reads the tof parameter format, starting from zero" << endl;
+		return coldStart();
+	}
+
+	ifstream infile( warmStartName.c_str() );
+	if ( !infile.is_open() ){
+		cout << "[calib." << __FUNCTION__ << "] Cannot open " << warmStartName << ", starting from zero" << endl;
+		return coldStart();
+	}
+
+	// read the whole file first so that a bad file leaves the state untouched
+	vector<double> edges[ constants::nChannels ], values[ constants::nChannels ];
+	for ( int i = constants::startWest; i < constants::endEast; i++ ){
+		int channel = -1, nBins = 0;
+		if ( !( infile >> channel >> nBins ) || channel < 1 || channel > constants::nChannels ){
+			cout << "[calib." << __FUNCTION__ << "] Bad file format in " << warmStartName << ", starting from zero" << endl;
+			return coldStart();
+		}
+		if ( nBins != numTOTBins ){
+			cout << "[calib." << __FUNCTION__ << "] " << warmStartName << " has " << nBins << " tot bins, this job " << numTOTBins << ". Set numTOTBins to match, starting from zero" << endl;
+			return coldStart();
+		}
+		edges[ channel - 1 ].resize( nBins + 1 );
+		values[ channel - 1 ].resize( nBins + 1 );
+		for ( int j = 0; j <= nBins; j++ )
+			infile >> edges[ channel - 1 ][ j ];
+		for ( int j = 0; j <= nBins; j++ )
+			infile >> values[ channel - 1 ][ j ];
+		if ( !infile ){
+			cout << "[calib." << __FUNCTION__ << "] " << warmStartName << " ends early, starting from zero" << endl;
+			return coldStart();
+		}
+	}
+
+	bool removeOffset = config.getAsBool( "removeOffset" );
+	int nLoaded = 0;
+	for ( int j = constants::startWest; j < constants::endEast; j++ ){
+		resumeTotBinsReady[ j ] = false;
+		if ( deadDetector[ j ] || values[ j ].empty() ) continue;
+
+		// a channel dead in the file has only zeros
+		bool empty = true;
+		for ( int k = 0; k <= numTOTBins; k++ )
+			empty = empty && 0 == values[ j ][ k ];
+		if ( empty ) continue;
+
+		// the offset writeParameters added, from this job's offsets
+		double off = 0;
+		if ( removeOffset )
+			off = initialOffsets[ j ] - finalWestOffset;
+		else if ( j >= constants::startEast && j < constants::endEast )
+			off = 0 - eastWestOffset;
+
+		for ( int k = 0; k <= numTOTBins; k++ )
+			totBins[ j ][ k ] = edges[ j ][ k ];
+		if ( useSpline ){
+			// the spline files hold the spline at minTOT, at the centres of bins 2 to n and at maxTOT
+			for ( int k = 1; k < numTOTBins; k++ )
+				correction[ j ][ k + 1 ] = values[ j ][ k ] - off;
+			// the centre of the first bin lies between minTOT and the centre of the second
+			double lo = minTOT;
+			double c1 = 0.5 * ( edges[ j ][ 0 ] + edges[ j ][ 1 ] );
+			double hi = numTOTBins > 1 ? 0.5 * ( edges[ j ][ 1 ] + edges[ j ][ 2 ] ) : maxTOT;
+			double f = hi > lo ? ( c1 - lo ) / ( hi - lo ) : 0;
+			correction[ j ][ 1 ] = ( 1 - f ) * values[ j ][ 0 ] + f * values[ j ][ 1 ] - off;
+		} else {
+			// value k is the correction of bin k + 1
+			for ( int k = 0; k < numTOTBins; k++ )
+				correction[ j ][ k + 1 ] = values[ j ][ k ] - off;
+		}
+		// the underflow bin takes the first bin
+		correction[ j ][ 0 ] = correction[ j ][ 1 ];
+
+		if ( useSpline ){
+			if ( spline[ j ] )
+				delete spline[ j ];
+			splineWeights[ j ].assign( numTOTBins, 1.0 );
+			spline[ j ] = buildSpline( totBins[ j ], &correction[ j ][ 1 ], &splineWeights[ j ][ 0 ], splineCoefficients[ j ] );
+		}
+		resumeTotBinsReady[ j ] = true;
+		nLoaded++;
+	}
+
+	// the first step uses the loaded bins like a resumed job
+	resumeIteration = currentIteration;
+	totBinsIteration = -1;
+
+	cout << "[calib." << __FUNCTION__ << "] Starting " << nLoaded << " channels from " << warmStartName << ", " << maxIterations
+		<< " steps from cut level " << cutOffset << " ( vzOutlierCut " << vzOutlierCut[ min( (size_t)cutOffset, vzOutlierCut.size() - 1 ) ] << " )" << endl;
+	return true;
+}
+
+/**
+ * A warm start that cannot be used runs the job from zero with its own steps and cut schedules
+ * @return false
+ */
+bool calib::coldStart( ){
+	maxIterations = coldIterations;
+	cutOffset = 0;
+	warmStartName = "";
+	return false;
+}
+
 /**
  * Reads parameter files in either to compare or to run
  * and produce calibration plots from the existing parameter files
@@ -2202,8 +4011,8 @@ void calib::stepReport() {
 	bool outliers = config.getAsBool( "outlierRejection" );
 
 	double vzCut = 40;
-	if ( currentIteration < vzOutlierCut.size() )
-		vzCut = vzOutlierCut[ currentIteration ];	// use the cut for this step
+	if ( cutLevel() < vzOutlierCut.size() )
+		vzCut = vzOutlierCut[ cutLevel() ];	// use the cut for this step
 	else 
 		vzCut = vzOutlierCut[ vzOutlierCut.size() - 1 ];	// after that use the last cut defined for all other steps
 
@@ -2310,8 +4119,8 @@ void calib::averageN() {
 	string iStr = "it"+ts(currentIteration);
 	double outlierCut = 2;
 
-	if ( currentIteration < avgNTimingCut.size() )
-		outlierCut = avgNTimingCut[ currentIteration ];	// use the cut for this step
+	if ( cutLevel() < avgNTimingCut.size() )
+		outlierCut = avgNTimingCut[ cutLevel() ];	// use the cut for this step
 	else 
 		outlierCut = avgNTimingCut[ avgNTimingCut.size() - 1 ];	// after that use the last cut defined for all other steps
 	
@@ -2328,10 +4137,7 @@ void calib::averageN() {
 	stringstream sstr;
 
 	// Alias the values for this event for ease
-	for( int j = constants::startWest; j < constants::endEast; j++) {
-		
-		if ( deadDetector[ j ] ) continue;
-		if ( !useDetector[ j ] ) continue;
+	for( int j : useDetector & ~deadDetector ) {
 
 		tot[ j ] = getX( j );
 		tdc[ j ] = getY( j );
@@ -2340,21 +4146,26 @@ void calib::averageN() {
 		
 		if(tot[ j ] <= minTOT || tot[ j ] > maxTOT) continue;
 			
-			corr[ j ] = getCorrection( j, tot[ j ] );
+			corr[ j ] = eventCorrection( j );
 			tAll[ j ] -= corr[ j ];
 	}
 
+	// both the average and the timing cut use every detector in this event
+	sideStats sideStat[ 2 ];
+	sideStat[ 0 ].set( tAll + constants::startWest, useDetector.westBits(), useDetector.westBits() );
+	sideStat[ 1 ].set( tAll + constants::startEast, useDetector.eastBits(), useDetector.eastBits() );
+
 	//reference = pico->vpdLeWest[0];
 	int start = constants::startWest;
-	int end = constants::endWest;
+	channelSet used = useDetector.west();
 
 	// loop over West then East and calculate the two sides seperately 
 	for ( int sides = 0; sides < 2; sides ++ ){
 		if ( 1 == sides){
 			start = constants::startEast;
-			end = constants::endEast;
+			used = useDetector.east();
 		}
-		for ( int i = start; i < end; i++ ){
+		for ( int i : used ){
 
 			book->cd( "channel" + ts( i ) );
 
@@ -2362,45 +4173,27 @@ void calib::averageN() {
 			double avg = 0;
 			double c = 0, a = 0; // tmp count and average variables used before cut
 
-			if ( !useDetector[ i ] ) continue;
-
 			if ( westIsGood && eastIsGood ){
 
 				// get the count and average with no cuts
-				for ( int j = start; j < end; j++ ){
-					if ( useDetector[ j ] && i != j ){
-						++c;
-						a += tAll[ j ];
-					}
-				}
-
+				c = sideStat[ sides ].mean( i - start, a );
 				
 				if ( c > 0 ){
-					// calculate the average
-					a /= c;
-
 					// fills the <N> variation within channel
-					for ( int j = start; j < end; j++ ){
-						if ( useDetector[ j ] && i != j ){
+					for ( int j : used ){
+						if ( i != j ){
 							book->get( iStr + "avgN" )->Fill( c, tAll[ j ] - a );	
 						}
 					}
-				}
-				
-				// now calculate the count and average with the timing cut 
-				for ( int j = start; j < end; j++ ){
-					if ( useDetector[ j ] && i != j && c > 0){	
-					// now reject events too far from the average time and redetermine count and average					
-						if ( 	tAll[ j ] - a > -outlierCut && tAll[ j ] - a < outlierCut ){
-							++count;
-							avg += tAll[ j ];
-						}
-					}
+
+					// now reject events too far from the average time and redetermine count and average
+					if ( medianReference )
+						count = sideStat[ sides ].median( i - start, avg );
+					else
+						count = sideStat[ sides ].cutMean( i - start, a, outlierCut, avg );
 				}
 
-				if ( count )
-					avg /= count;
-				else
+				if ( !count )
 					avg = -9999;
 
 				if ( count ){
@@ -0,0 +1,321 @@
+
+#include "calibDaemon.h"
+#include "utils.h"
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <csignal>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+
+// provides my own string shortcuts etc.
+using namespace jdbUtils;
+
+calibDaemon::calibDaemon( TChain * chain, uint nIterations, xmlConfig config ){
+
+	this->chain = chain;
+	this->nIterations = nIterations;
+
+	// the jobs only share the events when they are in memory
+	config.set( "inMemory", "true" );
+	this->config = config;
+
+	socketPath = config.getAsString( "daemonSocket", "vpdCalib.sock" );
+	nJobs = config.getAsInt( "daemonJobs", 1 );
+	if ( nJobs < 1 )
+		nJobs = 1;
+	listenFd = -1;
+
+	xmlConfig sConfig = config;
+	sConfig.set( "baseName", config.getAsString( "baseName" ) + "daemonSample_" );
+	sample = new calib( chain, nIterations, sConfig );
+}
+
+calibDaemon::~calibDaemon(){
+	if ( listenFd >= 0 ){
+		close( listenFd );
+		unlink( socketPath.c_str() );
+	}
+	delete sample;
+}
+
+bool calibDaemon::listen(){
+
+	struct sockaddr_un addr;
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sun_family = AF_UNIX;
+	if ( socketPath.size() >= sizeof( addr.sun_path ) ){
+		cout << "[calibDaemon." << __FUNCTION__ << "] Socket path " << socketPath << " is too long" << endl;
+		return false;
+	}
+	strcpy( addr.sun_path, socketPath.c_str() );
+
+	listenFd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if ( listenFd < 0 ){
+		cout << "[calibDaemon." << __FUNCTION__ << "] Cannot create the socket" << endl;
+		return false;
+	}
+
+	// left over from a daemon that did not stop cleanly
+	unlink( socketPath.c_str() );
+	if ( 0 != ::bind( listenFd, (struct sockaddr *)&addr, sizeof( addr ) ) || 0 != ::listen( listenFd, 16 ) ){
+		cout << "[calibDaemon." << __FUNCTION__ << "] Cannot listen on " << socketPath << endl;
+		close( listenFd );
+		listenFd = -1;
+		return false;
+	}
+
+	cout << "[calibDaemon." << __FUNCTION__ << "] Listening on " << socketPath << endl;
+	return true;
+}
+
+void calibDaemon::serve(){
+
+	// the data is read once, the children get a copy of the memory
+	sample->attachChain();
+	sample->cacheFirstPass();
+	sample->loadEventStore();
+
+	if ( !listen() )
+		return;
+
+	// a client that goes away must not end the daemon
+	signal( SIGPIPE, SIG_IGN );
+
+	int nRunning = 0;
+	int nServed = 0;
+	while ( true ){
+
+		reap( nRunning, false );
+
+		struct pollfd p;
+		p.fd = listenFd;
+		p.events = POLLIN;
+		if ( poll( &p, 1, 1000 ) <= 0 )
+			continue;
+
+		int client = accept( listenFd, NULL, NULL );
+		if ( client < 0 )
+			continue;
+
+		// at most nJobs at a time, the next client waits for a free slot
+		while ( nRunning >= nJobs )
+			reap( nRunning, true );
+
+		bool stop = handle( client, nRunning );
+		close( client );
+		if ( stop )
+			break;
+		nServed++;
+	}
+
+	while ( nRunning > 0 )
+		reap( nRunning, true );
+	cout << "[calibDaemon." << __FUNCTION__ << "] Stopping after " << nServed << " requests" << endl;
+}
+
+void calibDaemon::reap( int &nRunning, bool block ){
+	int status = 0;
+	pid_t pid = 0;
+	while ( nRunning > 0 && ( pid = waitpid( -1, &status, block ? 0 : WNOHANG ) ) > 0 ){
+		nRunning--;
+		if ( WIFEXITED( status ) && 0 == WEXITSTATUS( status ) )
+			cout << "[calibDaemon." << __FUNCTION__ << "] Job " << pid << " done" << endl;
+		else if ( WIFEXITED( status ) )
+			cout << "[calibDaemon." << __FUNCTION__ << "] Job " << pid << " failed with status " << WEXITSTATUS( status ) << endl;
+		else
+			cout << "[calibDaemon." << __FUNCTION__ << "] Job " << pid << " killed by signal " << ( WIFSIGNALED( status ) ? WTERMSIG( status ) : 0 ) << endl;
+		block = false;
+	}
+}
+
+bool calibDaemon::handle( int client, int &nRunning ){
+
+	// the client closes its side after the request : stop, or run with its directory and config file
+	// a client that stalls gives up its request instead of blocking the daemon
+	struct timeval timeout;
+	timeout.tv_sec = requestTimeout;
+	timeout.tv_usec = 0;
+	setsockopt( client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof( timeout ) );
+
+	string request = "";
+	char buffer[ 4096 ];
+	ssize_t n = 0;
+	while ( ( n = ::read( client, buffer, sizeof( buffer ) ) ) > 0 )
+		request.append( buffer, n );
+	if ( n < 0 ){
+		cout << "[calibDaemon." << __FUNCTION__ << "] No complete request within " << requestTimeout << " seconds" << endl;
+		reply( client, "failed request timed out" );
+		return false;
+	}
+
+	stringstream sstr( request );
+	string command, dir, configFile;
+	getline( sstr, command );
+	getline( sstr, dir );
+	getline( sstr, configFile );
+
+	if ( "stop" == command ){
+		reply( client, "stopping" );
+		return true;
+	}
+	if ( "run" != command || "" == dir || "" == configFile ){
+		reply( client, "failed bad request" );
+		return false;
+	}
+
+	cout << "[calibDaemon." << __FUNCTION__ << "] Job " << configFile << endl;
+
+	cout.flush();
+	fflush( stdout );
+	pid_t pid = fork();
+	if ( 0 == pid ){
+		close( listenFd );
+		bool ok = runJob( client, dir, configFile );
+		close( client );
+		_exit( ok ? 0 : 1 );
+	}
+
+	if ( pid < 0 ){
+		cout << "[calibDaemon." << __FUNCTION__ << "] Cannot fork" << endl;
+		reply( client, "failed cannot fork" );
+	} else
+		nRunning++;
+	return false;
+}
+
+bool calibDaemon::runJob( int client, const string &dir, const string &configFile ){
+
+	// the relative names of the job are the client's
+	if ( 0 != chdir( dir.c_str() ) ){
+		reply( client, "failed cannot enter " + dir );
+		return false;
+	}
+
+	try {
+		xmlConfig c( configFile.c_str() );
+		c.set( "inMemory", "true" );
+		string job = c.getAsString( "daemonJob", "calibrate" );
+		string baseName = c.getAsString( "baseName" );
+
+		if ( "calibrate" != job && "checkParams" != job && "paramReport" != job ){
+			reply( client, "failed unknown daemonJob " + job );
+			return false;
+		}
+		// the calibration reads its job from jobType, which is submit in the client's config
+		c.set( "jobType", job );
+		if ( c.getAsString( "dataDir" ) != config.getAsString( "dataDir" ) )
+			reply( client, "note the data of the daemon is used : " + config.getAsString( "dataDir" ) );
+
+		// the job logs to its own file
+		string log = baseName + "daemon.log";
+		reply( client, "log " + log );
+		if ( !freopen( log.c_str(), "w", stdout ) )
+			cout.setstate( ios::failbit );
+
+		{
+			calib jobCalib( chain, c.getAsInt( "numIterations", nIterations ), c );
+			jobCalib.attachChain();
+
+			if ( "paramReport" == job ){
+				jobCalib.readParameters();
+			} else if ( "checkParams" == job ){
+				if ( !jobCalib.shareEvents( *sample ) )
+					cout << "[calibDaemon." << __FUNCTION__ << "] reading the events" << endl;
+				jobCalib.readParameters();
+				jobCalib.checkStep();
+				jobCalib.step();
+				jobCalib.writeParameters();
+			} else {
+				if ( !jobCalib.shareFirstPass( *sample ) )
+					cout << "[calibDaemon." << __FUNCTION__ << "] reading the first pass" << endl;
+				if ( !jobCalib.shareEvents( *sample ) )
+					cout << "[calibDaemon." << __FUNCTION__ << "] reading the events" << endl;
+				jobCalib.binTOT( c.getAsBool( "variableBinning" ) );
+				jobCalib.offsets();
+				jobCalib.warmStart();
+				jobCalib.loop();
+				jobCalib.writeParameters();
+			}
+		}
+		cout.flush();
+		fflush( stdout );
+
+		// written once the calibration is destroyed
+		if ( "paramReport" != job )
+			reply( client, "params " + baseName + c.getAsString( "paramsOutput", "params.dat" ) );
+		reply( client, "root " + baseName + c.getAsString( "rootOutput" ) );
+		reply( client, "report " + baseName + c.getAsString( "reportOutput" ) );
+		reply( client, "ok" );
+		return true;
+
+	} catch ( ... ){
+		cout.flush();
+		fflush( stdout );
+		reply( client, "failed cannot run " + configFile );
+	}
+	return false;
+}
+
+bool calibDaemon::reply( int client, const string &line ){
+	string l = line + "\n";
+	return (ssize_t)l.size() == ::write( client, l.c_str(), l.size() );
+}
+
+int calibDaemon::submit( xmlConfig config, const char * configFile ){
+
+	string socketPath = config.getAsString( "daemonSocket", "vpdCalib.sock" );
+	struct sockaddr_un addr;
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sun_family = AF_UNIX;
+	if ( socketPath.size() >= sizeof( addr.sun_path ) ){
+		cout << "[calibDaemon." << __FUNCTION__ << "] Socket path " << socketPath << " is too long" << endl;
+		return 1;
+	}
+	strcpy( addr.sun_path, socketPath.c_str() );
+
+	int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if ( fd < 0 || 0 != connect( fd, (struct sockaddr *)&addr, sizeof( addr ) ) ){
+		cout << "[calibDaemon." << __FUNCTION__ << "] No daemon listening on " << socketPath << endl;
+		if ( fd >= 0 )
+			close( fd );
+		return 1;
+	}
+
+	string request = "stop\n";
+	if ( "stop" != config.getAsString( "daemonJob", "calibrate" ) ){
+		char dir[ PATH_MAX ], file[ PATH_MAX ];
+		if ( !getcwd( dir, sizeof( dir ) ) || !realpath( configFile, file ) ){
+			cout << "[calibDaemon." << __FUNCTION__ << "] Cannot resolve " << configFile << endl;
+			close( fd );
+			return 1;
+		}
+		request = "run\n" + string( dir ) + "\n" + string( file ) + "\n";
+	}
+
+	bool sent = (ssize_t)request.size() == ::write( fd, request.c_str(), request.size() );
+	shutdown( fd, SHUT_WR );
+
+	// the reply lines, the last one is ok when the job succeeded
+	string response = "";
+	char buffer[ 4096 ];
+	ssize_t n = 0;
+	while ( ( n = ::read( fd, buffer, sizeof( buffer ) ) ) > 0 )
+		response.append( buffer, n );
+	close( fd );
+
+	stringstream sstr( response );
+	string line, last = "";
+	while ( getline( sstr, line ) ){
+		cout << "[calibDaemon." << __FUNCTION__ << "] " << line << endl;
+		last = line;
+	}
+	return sent && ( "ok" == last || "stopping" == last ) ? 0 : 1;
+}
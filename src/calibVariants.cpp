@@ -0,0 +1,90 @@
+
+#include "calibVariants.h"
+#include "utils.h"
+#include <sstream>
+
+// provides my own string shortcuts etc.
+using namespace jdbUtils;
+
+calibVariants::calibVariants( TChain * chain, uint nIterations, xmlConfig config ){
+
+	// the events are only read once if they are kept in memory
+	if ( !config.nodeExists( "inMemory" ) )
+		config.set( "inMemory", "true" );
+	this->config = config;
+
+	vector<string> list = config.getAsStringVector( "variants" );
+	for ( unsigned int i = 0; i < list.size(); i++ ){
+		xmlConfig vConfig = variantConfig( config, list[ i ], config.getAsString( "baseName" ) + "variant" + ts( (int)i ) + "_" );
+		configs.push_back( vConfig );
+		names.push_back( vConfig.getAsString( "baseName" ) );
+
+		cout << "[calibVariants." << __FUNCTION__ << "] Variant " << i << " : " << list[ i ] << " -> " << names.back() << endl;
+		variants.push_back( new calib( chain, nIterations, vConfig ) );
+	}
+}
+
+calibVariants::~calibVariants(){
+	for ( unsigned int i = 0; i < variants.size(); i++ )
+		delete variants[ i ];
+}
+
+xmlConfig calibVariants::variantConfig( xmlConfig config, string overrides, string defaultName ){
+
+	config.set( "baseName", defaultName );
+
+	stringstream sstr( overrides );
+	string item;
+	while ( sstr >> item ){
+		size_t eq = item.find( '=' );
+		if ( string::npos == eq || 0 == eq ){
+			cout << "[calibVariants." << __FUNCTION__ << "] Ignoring " << item << ", expected option=value" << endl;
+			continue;
+		}
+		config.set( (char*)item.substr( 0, eq ).c_str(), item.substr( eq + 1 ) );
+	}
+	return config;
+}
+
+void calibVariants::calibrate(){
+
+	if ( variants.empty() ){
+		cout << "[calibVariants." << __FUNCTION__ << "] No variants given" << endl;
+		return;
+	}
+
+	// one read of the first passes for every variant that bins the same tot range
+	// all variants read the same chain so its branches are pointed at the variant reading it
+	variants[ 0 ]->attachChain();
+	variants[ 0 ]->cacheFirstPass();
+	for ( unsigned int i = 1; i < variants.size(); i++ ){
+		if ( !variants[ i ]->shareFirstPass( *variants[ 0 ] ) )
+			cout << "[calibVariants." << __FUNCTION__ << "] " << names[ i ] << " reads its own first pass" << endl;
+	}
+
+	for ( unsigned int i = 0; i < variants.size(); i++ ){
+		variants[ i ]->attachChain();
+		variants[ i ]->binTOT( configs[ i ].getAsBool( "variableBinning" ) );
+		variants[ i ]->offsets();
+		variants[ i ]->warmStart();
+	}
+
+	// the steps in lockstep, the first step of the first variant loads the events for all of them
+	bool running = true;
+	for ( int pass = 0; running; pass++ ){
+		running = false;
+		for ( unsigned int i = 0; i < variants.size(); i++ ){
+			if ( 0 == pass && i > 0 && !variants[ i ]->shareEvents( *variants[ 0 ] ) )
+				cout << "[calibVariants." << __FUNCTION__ << "] " << names[ i ] << " reads its own events" << endl;
+			variants[ i ]->attachChain();
+			if ( variants[ i ]->loopStep() )
+				running = true;
+		}
+	}
+
+	for ( unsigned int i = 0; i < variants.size(); i++ ){
+		variants[ i ]->attachChain();
+		variants[ i ]->finishLoop();
+		variants[ i ]->writeParameters();
+	}
+}
@@ -0,0 +1,198 @@
+
+#include "crossValidator.h"
+#include "splineMaker.h"
+#include "pSpline.h"
+#include "blockKernels.h"
+#include "utils.h"
+#include <cmath>
+
+void crossValidator::configure( int nFolds, int nFine, double lo, double hi ){
+	this->nFolds = nFolds;
+	this->nFine = nFine > 0 ? nFine : 1;
+	this->lo = lo;
+	this->hi = hi;
+	clear();
+}
+
+void crossValidator::clear(){
+	int n = constants::nChannels * nFine;
+	trainN.assign( n, 0 );
+	trainY.assign( n, 0 );
+	trainYY.assign( n, 0 );
+	validN.assign( n, 0 );
+	validX.assign( n, 0 );
+	validY.assign( n, 0 );
+	validYY.assign( n, 0 );
+}
+
+bool crossValidator::heldOut( int run, int evt ) const {
+	if ( !enabled() )
+		return false;
+	// a stream of its own, independent of the bootstrap weights
+	return 0 == jdbUtils::eventHash( run, evt, 1 << 20 ) % nFolds;
+}
+
+int crossValidator::fineBin( double x ) const {
+	if ( x < lo || x >= hi )
+		return -1;
+	int i = (int)( ( x - lo ) / ( hi - lo ) * nFine );
+	return i < nFine ? i : nFine - 1;
+}
+
+void crossValidator::fill( int channel, double x, double y, bool validation ){
+	int i = fineBin( x );
+	if ( i < 0 )
+		return;
+	i += channel * nFine;
+
+	if ( validation ){
+		validN[ i ]++;
+		validX[ i ] += x;
+		validY[ i ] += y;
+		validYY[ i ] += y * y;
+	} else {
+		trainN[ i ]++;
+		trainY[ i ] += y;
+		trainYY[ i ] += y * y;
+	}
+}
+
+void crossValidator::edges( int channel, int nBins, bool variableBinning, vector<double> &e ) const {
+
+	e.assign( nBins + 1, 0 );
+	double w = ( hi - lo ) / nFine;
+	e[ 0 ] = lo;
+	e[ nBins ] = hi;
+
+	if ( !variableBinning ){
+		for ( int j = 1; j < nBins; j++ )
+			e[ j ] = lo + ( hi - lo ) * j / nBins;
+		return;
+	}
+
+	// equal training statistics per bin at the resolution of the fine bins
+	const double * n = &trainN[ channel * nFine ];
+	double total = 0;
+	for ( int i = 0; i < nFine; i++ )
+		total += n[ i ];
+
+	double cumulative = 0;
+	int i = 0;
+	for ( int j = 1; j < nBins; j++ ){
+		double target = total * j / nBins;
+		while ( i < nFine && cumulative + n[ i ] < target )
+			cumulative += n[ i++ ];
+		double edge = lo + ( i + 1 ) * w;
+		// keep the edges increasing when a fine bin holds more than a bin's share
+		if ( edge <= e[ j - 1 ] )
+			edge = e[ j - 1 ] + w;
+		e[ j ] = edge < hi ? edge : hi;
+	}
+}
+
+double crossValidator::channelScore( int channel, const string &splineType, int nBins, bool variableBinning,
+										int splineSegments, double splineSmoothing ) const {
+
+	int base = channel * nFine;
+	double nTrain = 0, nValid = 0;
+	for ( int i = 0; i < nFine; i++ ){
+		nTrain += trainN[ base + i ];
+		nValid += validN[ base + i ];
+	}
+	// same threshold as a dead channel in binTOT
+	if ( nTrain < 100 || nValid < 10 || nBins < 1 )
+		return -1;
+
+	vector<double> e;
+	edges( channel, nBins, variableBinning, e );
+
+	// the profile of the training fold, empty bins have no correction like the totcor profile
+	double w = ( hi - lo ) / nFine;
+	vector<double> n( nBins, 0 ), sy( nBins, 0 ), syy( nBins, 0 );
+	for ( int i = 0; i < nFine; i++ ){
+		if ( 0 == trainN[ base + i ] ) continue;
+		int b = blockKernels::findBin( &e[ 0 ], nBins, lo + ( i + 0.5 ) * w ) - 1;
+		if ( b < 0 ) b = 0;
+		if ( b >= nBins ) b = nBins - 1;
+		n[ b ] += trainN[ base + i ];
+		sy[ b ] += trainY[ base + i ];
+		syy[ b ] += trainYY[ base + i ];
+	}
+
+	vector<double> mean( nBins, 0 ), weight( nBins, 0 ), centers( nBins, 0 );
+	for ( int b = 0; b < nBins; b++ ){
+		centers[ b ] = 0.5 * ( e[ b ] + e[ b + 1 ] );
+		if ( 0 == n[ b ] ) continue;
+		mean[ b ] = sy[ b ] / n[ b ];
+		double err2 = ( syy[ b ] / n[ b ] - mean[ b ] * mean[ b ] ) / n[ b ];
+		weight[ b ] = err2 > 0 ? 1.0 / err2 : 0;
+	}
+
+	// the candidate correction at the mean tot of each validation fine bin
+	vector<double> xs( nFine ), cs( nFine, 0 );
+	for ( int i = 0; i < nFine; i++ )
+		xs[ i ] = validN[ base + i ] > 0 ? validX[ base + i ] / validN[ base + i ] : lo + ( i + 0.5 ) * w;
+
+	if ( "none" == splineType ){
+		for ( int i = 0; i < nFine; i++ ){
+			int b = blockKernels::findBin( &e[ 0 ], nBins, xs[ i ] ) - 1;
+			if ( b < 0 ) b = 0;
+			if ( b >= nBins ) b = nBins - 1;
+			cs[ i ] = mean[ b ];
+		}
+	} else if ( "pspline" == splineType ){
+		pSpline p( e[ 0 ], e[ nBins ], splineSegments, splineSmoothing );
+		if ( !p.fit( &centers[ 0 ], &mean[ 0 ], &weight[ 0 ], nBins ) )
+			return -1;
+		for ( int i = 0; i < nFine; i++ )
+			cs[ i ] = p.eval( xs[ i ] );
+	} else {
+		Interpolation::Type type = Interpolation::kAKIMA;
+		if ( "linear" == splineType )
+			type = Interpolation::kLINEAR;
+		else if ( "cspline" == splineType )
+			type = Interpolation::kCSPLINE;
+		else if ( "akima" != splineType )
+			return -1;
+
+		vector<double> kx, ky;
+		splineMaker::knotsFromBins( &e[ 0 ], &mean[ 0 ], nBins, splineAlignment::center, kx, ky );
+		splineMaker s( kx, ky, type );
+		s.eval( &xs[ 0 ], &cs[ 0 ], nFine );
+	}
+
+	double sum = 0;
+	for ( int i = 0; i < nFine; i++ ){
+		double c = cs[ i ];
+		sum += validYY[ base + i ] - 2 * c * validY[ base + i ] + c * c * validN[ base + i ];
+	}
+	return sum > 0 ? sqrt( sum / nValid ) : 0;
+}
+
+vector<crossValidator::candidate> crossValidator::score( const vector<string> &splineTypes, const vector<int> &nBins, bool variableBinning,
+															int splineSegments, double splineSmoothing ) const {
+
+	vector<candidate> result;
+	for ( unsigned int ib = 0; ib < nBins.size(); ib++ ){
+		for ( unsigned int is = 0; is < splineTypes.size(); is++ ){
+			candidate c;
+			c.splineType = splineTypes[ is ];
+			c.nBins = nBins[ ib ];
+			c.channelWidth.assign( constants::nChannels, 0 );
+			c.width = 0;
+			c.nScored = 0;
+
+			for ( int ch = 0; ch < constants::nChannels; ch++ ){
+				double width = channelScore( ch, c.splineType, c.nBins, variableBinning, splineSegments, splineSmoothing );
+				if ( width < 0 ) continue;
+				c.channelWidth[ ch ] = width;
+				c.width += width;
+				c.nScored++;
+			}
+			if ( c.nScored > 0 )
+				c.width /= c.nScored;
+			result.push_back( c );
+		}
+	}
+	return result;
+}
@@ -0,0 +1,28 @@
+
+#include "eventStore.h"
+
+template< typename T >
+void basicEventStore< T >::finish(){
+
+	if ( blocks.empty() )
+		return;
+
+	block_type &b = blocks.back();
+	if ( 0 == b.n )
+		return;
+
+	for ( int l = b.n; l < block_type::width; l++ ){
+		for ( int ch = 0; ch < constants::nChannels; ch++ ){
+			b.x[ ch ][ l ] = b.x[ ch ][ b.n - 1 ];
+			b.y[ ch ][ l ] = b.y[ ch ][ b.n - 1 ];
+		}
+		b.yRef[ l ] = b.yRef[ b.n - 1 ];
+		b.vertexZ[ l ] = b.vertexZ[ b.n - 1 ];
+		b.run[ l ] = b.run[ b.n - 1 ];
+		b.evt[ l ] = b.evt[ b.n - 1 ];
+		b.runEntry[ l ] = b.runEntry[ b.n - 1 ];
+	}
+}
+
+template class basicEventStore< double >;
+template class basicEventStore< float >;
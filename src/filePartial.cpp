@@ -0,0 +1,185 @@
+
+#include "filePartial.h"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+
+void filePartial::setup( int nChannels, int sketchBins, int offsetBins, int rawBins ){
+	this->nChannels = nChannels;
+	this->sketchBins = sketchBins;
+	this->offsetBins = offsetBins;
+	this->rawBins = rawBins;
+	clear();
+}
+
+void filePartial::clear(){
+	sketch.assign( (size_t)nChannels * sketchBins, 0 );
+	offset.assign( (size_t)nChannels * ( offsetBins + 2 ), 0 );
+	raw.assign( (size_t)nChannels * ( rawBins + 2 ), 0 );
+	events = 0;
+}
+
+bool filePartial::add( const filePartial &other ){
+	if ( 	other.nChannels != nChannels || other.sketchBins != sketchBins ||
+			other.offsetBins != offsetBins || other.rawBins != rawBins )
+		return false;
+
+	for ( size_t i = 0; i < sketch.size(); i++ )
+		sketch[ i ] += other.sketch[ i ];
+	for ( size_t i = 0; i < offset.size(); i++ )
+		offset[ i ] += other.offset[ i ];
+	for ( size_t i = 0; i < raw.size(); i++ )
+		raw[ i ] += other.raw[ i ];
+	events += other.events;
+	return true;
+}
+
+void filePartial::fillSketch( int ch, double x, double lo, double hi ){
+	int b = (int)( sketchBins * ( x - lo ) / ( hi - lo ) );
+	if ( b < 0 )
+		b = 0;
+	if ( b >= sketchBins )
+		b = sketchBins - 1;
+	sketch[ ch * sketchBins + b ]++;
+}
+
+long filePartial::sketchCount( int ch ) const {
+	double n = 0;
+	for ( int b = 0; b < sketchBins; b++ )
+		n += sketch[ ch * sketchBins + b ];
+	return (long)n;
+}
+
+double filePartial::sketchValue( int ch, long rank, double lo, double hi ) const {
+	double width = ( hi - lo ) / sketchBins;
+	double below = 0;
+	for ( int b = 0; b < sketchBins; b++ ){
+		double n = sketch[ ch * sketchBins + b ];
+		if ( n > 0 && rank < below + n )
+			return lo + width * ( b + ( rank - below + 0.5 ) / n );
+		below += n;
+	}
+	return hi;
+}
+
+int filePartial::fixBin( double x, int nBins, double lo, double hi ){
+	if ( x < lo )
+		return 0;
+	if ( !( x < hi ) )
+		return nBins + 1;
+	return 1 + int( nBins * ( x - lo ) / ( hi - lo ) );
+}
+
+void filePartial::writeSparse( ostream &out, string key, const vector<double> &v ){
+	size_t n = 0;
+	for ( size_t i = 0; i < v.size(); i++ )
+		if ( 0 != v[ i ] ) n++;
+	out << key << " " << n;
+	for ( size_t i = 0; i < v.size(); i++ ){
+		if ( 0 != v[ i ] )
+			out << " " << i << " " << v[ i ];
+	}
+	out << endl;
+}
+
+bool filePartial::readSparse( istream &in, string key, vector<double> &v ){
+	string k;
+	size_t n = 0;
+	in >> k >> n;
+	if ( k != key )
+		return false;
+	for ( size_t j = 0; j < n; j++ ){
+		size_t i = 0;
+		double c = 0;
+		in >> i >> c;
+		if ( !in || i >= v.size() )
+			return false;
+		v[ i ] = c;
+	}
+	return !in.fail();
+}
+
+bool filePartial::write( string name ) const {
+
+	string tmpName = name + ".tmp";
+	ofstream f( tmpName.c_str() );
+	if ( !f.is_open() )
+		return false;
+	f << setprecision( 17 );
+
+	f << "# vpd first pass partials" << endl;
+	f << "version " << version << endl;
+	f << "setup " << nChannels << " " << sketchBins << " " << offsetBins << " " << rawBins << " " << events << endl;
+	writeSparse( f, "sketch", sketch );
+	writeSparse( f, "offset", offset );
+	writeSparse( f, "raw", raw );
+	f.close();
+
+	if ( f.fail() )
+		return false;
+	return 0 == rename( tmpName.c_str(), name.c_str() );
+}
+
+bool filePartial::read( string name ){
+
+	ifstream f( name.c_str() );
+	if ( !f.is_open() )
+		return false;
+
+	string line, key;
+	getline( f, line );
+
+	int v = 0;
+	f >> key >> v;
+	if ( "version" != key || version != v )
+		return false;
+
+	int nc = 0, sb = 0, ob = 0, rb = 0;
+	long ne = 0;
+	f >> key >> nc >> sb >> ob >> rb >> ne;
+	if ( "setup" != key || !f )
+		return false;
+	setup( nc, sb, ob, rb );
+	events = ne;
+
+	if ( readSparse( f, "sketch", sketch ) && readSparse( f, "offset", offset ) && readSparse( f, "raw", raw ) )
+		return true;
+
+	// a damaged entry is read again from the data
+	clear();
+	return false;
+}
+
+uint64_t filePartial::fnv( const char * data, size_t n, uint64_t h ){
+	for ( size_t i = 0; i < n; i++ ){
+		h ^= (unsigned char)data[ i ];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+string filePartial::hex( uint64_t h ){
+	stringstream sstr;
+	sstr << std::hex << setw( 16 ) << setfill( '0' ) << h;
+	return sstr.str();
+}
+
+string filePartial::hashFile( string name ){
+
+	ifstream f( name.c_str(), ios::in | ios::binary );
+	if ( !f.is_open() )
+		return "";
+
+	uint64_t h = 14695981039346656037ULL;
+	vector<char> buffer( 1 << 20 );
+	while ( f ){
+		f.read( &buffer[ 0 ], buffer.size() );
+		h = fnv( &buffer[ 0 ], f.gcount(), h );
+	}
+	return hex( h );
+}
+
+string filePartial::hashString( string s ){
+	return hex( fnv( s.c_str(), s.size(), 14695981039346656037ULL ) );
+}
@@ -0,0 +1,147 @@
+
+#include "globalSolver.h"
+#include <cmath>
+
+void globalSolver::setup( int nChannels, int nBins ){
+	this->nChannels = nChannels;
+	this->nBins = nBins;
+	n = nChannels * nBins;
+	clear();
+}
+
+void globalSolver::clear(){
+	a.assign( (size_t)n * n, 0 );
+	b.assign( n, 0 );
+	count.assign( n, 0 );
+	sumSq = 0;
+	nEvents = 0;
+	nHits = 0;
+}
+
+void globalSolver::add( const int * channels, const int * bins, const double * values, int nHits ){
+
+	int k[ 64 ];
+	double v[ 64 ];
+	int m = 0;
+	for ( int i = 0; i < nHits && m < 64; i++ ){
+		if ( bins[ i ] < 1 || bins[ i ] > nBins || channels[ i ] < 0 || channels[ i ] >= nChannels ) continue;
+		k[ m ] = channels[ i ] * nBins + bins[ i ] - 1;
+		v[ m ] = values[ i ];
+		m++;
+	}
+	// a single hit has no residual
+	if ( m < 2 )
+		return;
+
+	double mean = 0;
+	for ( int i = 0; i < m; i++ )
+		mean += v[ i ];
+	mean /= (double)m;
+
+	// the residuals are P ( v - c ) with the centering matrix P = I - 1 1^T / m
+	double w = 1.0 / (double)m;
+	for ( int i = 0; i < m; i++ ){
+		double * row = &a[ (size_t)k[ i ] * n ];
+		row[ k[ i ] ] += 1.0;
+		for ( int l = 0; l < m; l++ )
+			row[ k[ l ] ] -= w;
+		b[ k[ i ] ] += v[ i ] - mean;
+		count[ k[ i ] ]++;
+		sumSq += ( v[ i ] - mean ) * ( v[ i ] - mean );
+	}
+	nEvents++;
+	this->nHits += m;
+}
+
+bool globalSolver::solve( double ridge, vector<double> &c ) const {
+
+	c.assign( n, 0 );
+	if ( 0 == nEvents )
+		return false;
+
+	double diag = 0;
+	int nUsed = 0;
+	for ( int i = 0; i < n; i++ ){
+		if ( 0 == count[ i ] ) continue;
+		diag += a[ (size_t)i * n + i ];
+		nUsed++;
+	}
+	diag /= (double)nUsed;
+
+	vector<double> l( a );
+	for ( int i = 0; i < n; i++ )
+		l[ (size_t)i * n + i ] += ridge * diag;
+
+	if ( !cholesky( &l[ 0 ], n ) )
+		return false;
+
+	c = b;
+	solveCholesky( &l[ 0 ], n, &c[ 0 ] );
+
+	// fix the free shift with the hit weighted mean
+	double shift = 0;
+	for ( int i = 0; i < n; i++ )
+		shift += count[ i ] * c[ i ];
+	shift /= (double)nHits;
+	for ( int i = 0; i < n; i++ )
+		c[ i ] = count[ i ] ? c[ i ] - shift : 0;
+
+	return true;
+}
+
+double globalSolver::chi2( const vector<double> &c ) const {
+
+	// c^T A c - 2 b^T c + sum ( v - < v > )^2
+	double r = sumSq;
+	for ( int i = 0; i < n; i++ ){
+		if ( 0 == count[ i ] ) continue;
+		const double * row = &a[ (size_t)i * n ];
+		double ac = 0;
+		for ( int j = 0; j < n; j++ )
+			ac += row[ j ] * c[ j ];
+		r += c[ i ] * ac - 2 * b[ i ] * c[ i ];
+	}
+	return r;
+}
+
+bool globalSolver::cholesky( double * a, int n ){
+
+	for ( int j = 0; j < n; j++ ){
+		double * rj = a + (size_t)j * n;
+		double d = rj[ j ];
+		for ( int k = 0; k < j; k++ )
+			d -= rj[ k ] * rj[ k ];
+		if ( !( d > 0 ) )
+			return false;
+		d = sqrt( d );
+		rj[ j ] = d;
+
+		for ( int i = j + 1; i < n; i++ ){
+			double * ri = a + (size_t)i * n;
+			double s = ri[ j ];
+			for ( int k = 0; k < j; k++ )
+				s -= ri[ k ] * rj[ k ];
+			ri[ j ] = s / d;
+		}
+	}
+	return true;
+}
+
+void globalSolver::solveCholesky( const double * l, int n, double * x ){
+
+	// L y = x
+	for ( int i = 0; i < n; i++ ){
+		const double * ri = l + (size_t)i * n;
+		double s = x[ i ];
+		for ( int k = 0; k < i; k++ )
+			s -= ri[ k ] * x[ k ];
+		x[ i ] = s / ri[ i ];
+	}
+	// L^T x = y
+	for ( int i = n - 1; i >= 0; i-- ){
+		double s = x[ i ];
+		for ( int k = i + 1; k < n; k++ )
+			s -= l[ (size_t)k * n + i ] * x[ k ];
+		x[ i ] = s / l[ (size_t)i * n + i ];
+	}
+}
@@ -0,0 +1,245 @@
+
+#include "onlineCalib.h"
+#include "calib.h"
+#include "utils.h"
+#include <fstream>
+#include <ctime>
+#include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+// provides my own string shortcuts etc.
+using namespace jdbUtils;
+
+onlineCalib::onlineCalib( uint nIterations, xmlConfig config ){
+
+	this->nIterations = nIterations;
+
+	baseName = config.getAsString( "baseName" );
+	dir = config.getAsString( "dataDir" );
+	// the file names are appended to the directory as in chainLoader
+	if ( "" != dir && '/' != dir[ dir.size() - 1 ] )
+		dir += "/";
+
+	interval = config.getAsDouble( "onlineInterval", 600 );
+	minEvents = config.getAsInt( "onlineMinEvents", 100000 );
+	settleSeconds = config.getAsDouble( "onlineSettle", 30 );
+	precisionGain = config.getAsDouble( "onlinePrecisionGain", 0.1 );
+
+	// the refreshes only read the first passes of the new files
+	if ( !config.nodeExists( "cacheDir" ) ){
+		string cache = baseName + "onlineCache";
+		mkdir( cache.c_str(), 0755 );
+		config.set( "cacheDir", cache );
+	}
+	this->config = config;
+
+	chain = new TChain( "tof" );
+	eventsAtRefresh = 0;
+	bestPrecision = -1;
+	nRefresh = 0;
+	nPublished = 0;
+	notifyFd = -1;
+	watchFd = -1;
+}
+
+onlineCalib::~onlineCalib(){
+	if ( notifyFd >= 0 )
+		close( notifyFd );
+	delete chain;
+}
+
+void onlineCalib::watch(){
+	notifyFd = inotify_init1( IN_NONBLOCK );
+	if ( notifyFd >= 0 )
+		watchFd = inotify_add_watch( notifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO );
+
+	if ( notifyFd < 0 || watchFd < 0 ){
+		cout << "[onlineCalib." << __FUNCTION__ << "] Cannot watch " << dir << ", polling every minute instead" << endl;
+		if ( notifyFd >= 0 )
+			close( notifyFd );
+		notifyFd = -1;
+	} else
+		cout << "[onlineCalib." << __FUNCTION__ << "] Watching " << dir << endl;
+}
+
+bool onlineCalib::addFile( string name ){
+	if ( string::npos == name.find( "root" ) || files.count( name ) )
+		return false;
+	files.insert( name );
+	chain->Add( name.c_str() );
+	cout << "[onlineCalib." << __FUNCTION__ << "] Adding file " << name << " to chain" << endl;
+	return true;
+}
+
+int onlineCalib::scan(){
+
+	DIR * d = opendir( dir.c_str() );
+	if ( !d )
+		return 0;
+
+	int nAdded = 0;
+	time_t now = time( NULL );
+	struct dirent * ent;
+	while ( ( ent = readdir( d ) ) != NULL ){
+		string name = dir + ent->d_name;
+		if ( string::npos == name.find( "root" ) || files.count( name ) ) continue;
+
+		// a file still being written changes within the settle time
+		struct stat st;
+		if ( 0 != stat( name.c_str(), &st ) || !S_ISREG( st.st_mode ) ) continue;
+		if ( difftime( now, st.st_mtime ) < settleSeconds ) continue;
+
+		if ( addFile( name ) )
+			nAdded++;
+	}
+	closedir( d );
+	return nAdded;
+}
+
+int onlineCalib::wait( double seconds ){
+
+	int nAdded = 0;
+	if ( notifyFd >= 0 ){
+		struct pollfd p;
+		p.fd = notifyFd;
+		p.events = POLLIN;
+		if ( poll( &p, 1, (int)( seconds * 1000 ) ) > 0 ){
+			// the closed and moved in files are complete
+			char buffer[ 64 * ( sizeof( struct inotify_event ) + 256 ) ];
+			ssize_t n = 0;
+			while ( ( n = read( notifyFd, buffer, sizeof( buffer ) ) ) > 0 ){
+				for ( char * b = buffer; b < buffer + n; ){
+					struct inotify_event * e = (struct inotify_event *)b;
+					if ( e->len > 0 && addFile( dir + e->name ) )
+						nAdded++;
+					b += sizeof( struct inotify_event ) + e->len;
+				}
+			}
+		}
+	} else
+		sleep( (unsigned int)seconds );
+
+	// files the watch cannot see, e.g. written from another host on a network file system
+	return nAdded + scan();
+}
+
+bool onlineCalib::stopRequested( double start ){
+	string stopFile = baseName + config.getAsString( "onlineStopFile", "online.stop" );
+	if ( 0 == access( stopFile.c_str(), F_OK ) ){
+		cout << "[onlineCalib." << __FUNCTION__ << "] Found " << stopFile << ", stopping" << endl;
+		return true;
+	}
+	double maxHours = config.getAsDouble( "onlineMaxHours", 0 );
+	if ( maxHours > 0 && wallTime() - start > maxHours * 3600 ){
+		cout << "[onlineCalib." << __FUNCTION__ << "] Ran for " << maxHours << " hours, stopping" << endl;
+		return true;
+	}
+	return false;
+}
+
+void onlineCalib::run(){
+
+	if ( string::npos != config.getAsString( "dataDir" ).find( ".lis" ) ){
+		cout << "[onlineCalib." << __FUNCTION__ << "] The online job needs a directory as dataDir, not a file list" << endl;
+		return;
+	}
+
+	double start = wallTime();
+	double lastRefresh = start - interval;
+
+	watch();
+	scan();
+
+	while ( !stopRequested( start ) ){
+
+		Long64_t events = chain->GetEntries();
+		double now = wallTime();
+		if ( events - eventsAtRefresh >= minEvents && now - lastRefresh >= interval ){
+			refresh();
+			eventsAtRefresh = events;
+			lastRefresh = wallTime();
+		}
+
+		wait( 60 );
+	}
+
+	cout << "[onlineCalib." << __FUNCTION__ << "] " << nRefresh << " refreshes, " << nPublished << " published, " << files.size() << " files" << endl;
+}
+
+void onlineCalib::refresh(){
+
+	string stamp = timestamp();
+	cout << endl << "[onlineCalib." << __FUNCTION__ << "] Refresh " << nRefresh << " at " << stamp << " : " << files.size() << " files, " << chain->GetEntries() << " events" << endl << endl;
+
+	// the working outputs are overwritten by every refresh, the first one starts from zero
+	xmlConfig c = config;
+	string work = baseName + "onlineWork_";
+	c.set( "baseName", work );
+	if ( nRefresh > 0 && !config.nodeExists( "warmStart" ) )
+		c.set( "warmStart", work + config.getAsString( "paramsOutput", "params.dat" ) );
+
+	double precision = 0, resolution = 0, vzResolution = 0;
+	{
+		// destroyed before publishing so that its root file and report are written
+		calib refreshCalib( chain, nIterations, c );
+		refreshCalib.binTOT( c.getAsBool( "variableBinning" ) );
+		refreshCalib.offsets();
+		refreshCalib.warmStart();
+		refreshCalib.loop();
+		refreshCalib.writeParameters();
+
+		precision = refreshCalib.precision();
+		resolution = refreshCalib.averageResolution();
+		vzResolution = refreshCalib.vertexResolution();
+	}
+	nRefresh++;
+
+	cout << "[onlineCalib." << __FUNCTION__ << "] Precision " << precision << " ns, resolution " << resolution << " ns, vz width " << vzResolution << " cm" << endl;
+
+	if ( precision > 0 && ( bestPrecision < 0 || precision <= bestPrecision * ( 1.0 - precisionGain ) ) ){
+		publish( stamp, precision, resolution, vzResolution );
+		bestPrecision = precision;
+	}
+}
+
+void onlineCalib::publish( const string &stamp, double precision, double resolution, double vzResolution ){
+
+	string work = baseName + "onlineWork_";
+	string params = baseName + stamp + "_" + config.getAsString( "paramsOutput", "params.dat" );
+	if ( !copyFile( work + config.getAsString( "paramsOutput", "params.dat" ), params ) ){
+		cout << "[onlineCalib." << __FUNCTION__ << "] Cannot write " << params << endl;
+		return;
+	}
+	copyFile( work + config.getAsString( "reportOutput" ), baseName + stamp + "_" + config.getAsString( "reportOutput" ) );
+
+	// one line per published calibration
+	string sName = baseName + config.getAsString( "onlineSummaryOutput", "onlineSummary.dat" );
+	bool exists = ( 0 == access( sName.c_str(), F_OK ) );
+	ofstream f( sName.c_str(), ios::app );
+	if ( !exists )
+		f << "# time files events precision[ns] resolution[ns] vzWidth[cm] params" << endl;
+	f << stamp << " " << files.size() << " " << chain->GetEntries() << " " << precision << " " << resolution << " " << vzResolution << " " << params << endl;
+	f.close();
+
+	nPublished++;
+	cout << "[onlineCalib." << __FUNCTION__ << "] Published " << params << ( bestPrecision > 0 ? " ( precision improved from " + ts( bestPrecision ) + " ns )" : "" ) << endl;
+}
+
+string onlineCalib::timestamp(){
+	char buffer[ 32 ];
+	time_t now = time( NULL );
+	strftime( buffer, sizeof( buffer ), "%Y%m%d_%H%M%S", localtime( &now ) );
+	return buffer;
+}
+
+bool onlineCalib::copyFile( const string &from, const string &to ){
+	ifstream in( from.c_str(), ios::binary );
+	if ( !in.is_open() )
+		return false;
+	ofstream out( to.c_str(), ios::binary );
+	out << in.rdbuf();
+	return out.good();
+}
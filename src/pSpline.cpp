@@ -0,0 +1,116 @@
+
+#include "pSpline.h"
+#include "splineMaker.h"
+#include "globalSolver.h"
+#include <cmath>
+
+pSpline::pSpline( double xmin, double xmax, int nSegments, double lambda ){
+	this->xmin = xmin;
+	this->xmax = xmax;
+	this->nSegments = nSegments > 0 ? nSegments : 1;
+	this->lambda = lambda;
+	h = ( xmax - xmin ) / this->nSegments;
+	fitted = false;
+	coef.assign( this->nSegments + 3, 0 );
+}
+
+void pSpline::basis( double t, double * b ){
+	double s = 1.0 - t;
+	double t2 = t * t, t3 = t2 * t;
+	b[ 0 ] = s * s * s / 6.0;
+	b[ 1 ] = ( 3.0 * t3 - 6.0 * t2 + 4.0 ) / 6.0;
+	b[ 2 ] = ( -3.0 * t3 + 3.0 * t2 + 3.0 * t + 1.0 ) / 6.0;
+	b[ 3 ] = t3 / 6.0;
+}
+
+int pSpline::locate( double x, double &t ) const {
+	double u = ( x - xmin ) / h;
+	int i = (int)floor( u );
+	if ( i < 0 )
+		i = 0;
+	if ( i > nSegments - 1 )
+		i = nSegments - 1;
+	t = u - i;
+	return i;
+}
+
+bool pSpline::fit( const double * x, const double * y, const double * w, int n ){
+
+	fitted = false;
+	int m = nSegments + 3;
+	if ( !( h > 0 ) )
+		return false;
+
+	// B^T W B and B^T W y, four coefficients per point
+	vector< double > a( m * m, 0 ), r( m, 0 );
+	double sumW = 0;
+	int nUsed = 0;
+	for ( int k = 0; k < n; k++ ){
+		if ( !( w[ k ] > 0 ) || x[ k ] < xmin || x[ k ] > xmax ) continue;
+		double t = 0, b[ 4 ];
+		int i = locate( x[ k ], t );
+		basis( t, b );
+		for ( int p = 0; p < 4; p++ ){
+			for ( int q = 0; q < 4; q++ )
+				a[ ( i + p ) * m + i + q ] += w[ k ] * b[ p ] * b[ q ];
+			r[ i + p ] += w[ k ] * b[ p ] * y[ k ];
+		}
+		sumW += w[ k ];
+		nUsed++;
+	}
+	if ( 0 == nUsed )
+		return false;
+
+	// + lambda D^T D with the second difference rows ( 1, -2, 1 )
+	double l = lambda * sumW / m;
+	const double d[ 3 ] = { 1, -2, 1 };
+	for ( int j = 0; j + 2 < m; j++ ){
+		for ( int p = 0; p < 3; p++ )
+			for ( int q = 0; q < 3; q++ )
+				a[ ( j + p ) * m + j + q ] += l * d[ p ] * d[ q ];
+	}
+	// keeps coefficients without data or penalty ( lambda = 0 ) solvable
+	for ( int j = 0; j < m; j++ )
+		a[ j * m + j ] += 1e-10 * sumW / m;
+
+	if ( !globalSolver::cholesky( &a[ 0 ], m ) )
+		return false;
+	globalSolver::solveCholesky( &a[ 0 ], m, &r[ 0 ] );
+
+	coef = r;
+	fitted = true;
+	return true;
+}
+
+double pSpline::eval( double x ) const {
+	if ( x < xmin )
+		x = xmin;
+	if ( x > xmax )
+		x = xmax;
+	double t = 0, b[ 4 ];
+	int i = locate( x, t );
+	basis( t, b );
+	return coef[ i ] * b[ 0 ] + coef[ i + 1 ] * b[ 1 ] + coef[ i + 2 ] * b[ 2 ] + coef[ i + 3 ] * b[ 3 ];
+}
+
+splineMaker * pSpline::makeSpline() const {
+
+	if ( !fitted )
+		return NULL;
+
+	// power form of each segment in u = x - knot
+	vector< double > knots( nSegments + 1 ), c0( nSegments ), c1( nSegments ), c2( nSegments ), c3( nSegments );
+	for ( int i = 0; i <= nSegments; i++ )
+		knots[ i ] = xmin + i * h;
+	knots[ nSegments ] = xmax;
+
+	for ( int i = 0; i < nSegments; i++ ){
+		double a0 = coef[ i ], a1 = coef[ i + 1 ], a2 = coef[ i + 2 ], a3 = coef[ i + 3 ];
+		c0[ i ] = ( a0 + 4.0 * a1 + a2 ) / 6.0;
+		c1[ i ] = ( a2 - a0 ) / 2.0 / h;
+		c2[ i ] = ( a0 - 2.0 * a1 + a2 ) / 2.0 / ( h * h );
+		c3[ i ] = ( -a0 + 3.0 * a1 - 3.0 * a2 + a3 ) / 6.0 / ( h * h * h );
+	}
+
+	return new splineMaker( knots, c0, c1, c2, c3 );
+}
@@ -0,0 +1,152 @@
+
+#include "runGroups.h"
+#include "TOFrPicoDst.h"
+#include "calib.h"
+#include "utils.h"
+#include <fstream>
+#include <algorithm>
+
+// provides my own string shortcuts etc.
+using namespace jdbUtils;
+
+runGroups::runGroups( TChain * chain, xmlConfig config ){
+	this->chain = chain;
+	this->config = config;
+}
+
+void runGroups::scan(){
+
+	cout << "[runGroups." << __FUNCTION__ << "] " << " Start " << endl;
+
+	runEntries.clear();
+	runEvents.clear();
+
+	TOFrPicoDst pico( chain );
+	Long64_t nevents = chain->GetEntries();
+	for ( Long64_t i = 0; i < nevents; i++ ){
+		progressBar( i, nevents, 75 );
+
+		Long64_t entry = pico.LoadTree( i );
+		if ( entry < 0 || !pico.b_run ) continue;
+		pico.b_run->GetEntry( entry );
+
+		// the events of a run are mostly consecutive so they are kept as ranges
+		vector< pair< Long64_t, Long64_t > > &r = runEntries[ pico.run ];
+		if ( !r.empty() && r.back().second == i )
+			r.back().second++;
+		else
+			r.push_back( make_pair( i, i + 1 ) );
+		runEvents[ pico.run ]++;
+	}
+
+	cout << "[runGroups." << __FUNCTION__ << "] " << runEvents.size() << " runs in " << nevents << " events" << endl;
+}
+
+void runGroups::merge( group &into, const group &g ){
+	into.firstRun = min( into.firstRun, g.firstRun );
+	into.lastRun = max( into.lastRun, g.lastRun );
+	into.nRuns += g.nRuns;
+	into.events += g.events;
+	into.ranges.insert( into.ranges.end(), g.ranges.begin(), g.ranges.end() );
+}
+
+void runGroups::makeGroups( const vector<int> &starts, long minEvents ){
+
+	vector<int> s = starts;
+	sort( s.begin(), s.end() );
+
+	// consecutive runs with the same start are one group
+	vector<group> all;
+	long lastKey = -1;
+	for ( map< int, long >::iterator it = runEvents.begin(); it != runEvents.end(); ++it ){
+		int run = it->first;
+		long key = s.empty() ? run : upper_bound( s.begin(), s.end(), run ) - s.begin();
+
+		group g;
+		g.firstRun = run;
+		g.lastRun = run;
+		g.nRuns = 1;
+		g.events = it->second;
+		g.ranges = runEntries[ run ];
+		g.vzResolution = 0;
+
+		if ( !all.empty() && key == lastKey )
+			merge( all.back(), g );
+		else
+			all.push_back( g );
+		lastKey = key;
+	}
+
+	// minimum statistics, a small group takes the following one
+	groups.clear();
+	for ( unsigned int i = 0; i < all.size(); i++ ){
+		if ( !groups.empty() && groups.back().events < minEvents )
+			merge( groups.back(), all[ i ] );
+		else
+			groups.push_back( all[ i ] );
+	}
+	if ( groups.size() > 1 && groups.back().events < minEvents ){
+		merge( groups[ groups.size() - 2 ], groups.back() );
+		groups.pop_back();
+	}
+
+	string baseName = config.getAsString( "baseName" );
+	for ( unsigned int i = 0; i < groups.size(); i++ ){
+		groups[ i ].baseName = baseName + "runs_" + ts( groups[ i ].firstRun ) + "_" + ts( groups[ i ].lastRun ) + "_";
+		cout << "[runGroups." << __FUNCTION__ << "] Group " << i << " : runs " << groups[ i ].firstRun << " - " << groups[ i ].lastRun
+			<< " ( " << groups[ i ].nRuns << " runs, " << groups[ i ].events << " events )" << endl;
+	}
+}
+
+void runGroups::calibrate( uint nIterations ){
+
+	for ( unsigned int i = 0; i < groups.size(); i++ ){
+		group &g = groups[ i ];
+
+		cout << endl << "[runGroups." << __FUNCTION__ << "] Calibrating group " << i << " of " << groups.size() << " : runs " << g.firstRun << " - " << g.lastRun << endl << endl;
+
+		// the group's entries in chain order so that the files are read sequentially
+		vector<Long64_t> entries;
+		entries.reserve( g.events );
+		for ( unsigned int r = 0; r < g.ranges.size(); r++ ){
+			for ( Long64_t e = g.ranges[ r ].first; e < g.ranges[ r ].second; e++ )
+				entries.push_back( e );
+		}
+		sort( entries.begin(), entries.end() );
+
+		xmlConfig gConfig = config;
+		gConfig.set( "baseName", g.baseName );
+		gConfig.set( "firstRun", ts( g.firstRun ) );
+		gConfig.set( "lastRun", ts( g.lastRun ) );
+
+		// destroyed at the end of the group so its root file and report are written
+		calib groupCalib( chain, nIterations, gConfig );
+		groupCalib.setEntries( entries );
+
+		groupCalib.binTOT( config.getAsBool( "variableBinning" ) );
+		groupCalib.offsets();
+		groupCalib.warmStart();
+		groupCalib.loop();
+		groupCalib.writeParameters();
+
+		g.vzResolution = groupCalib.vertexResolution();
+	}
+
+	writeSummary();
+}
+
+void runGroups::writeSummary(){
+
+	string name = config.getAsString( "baseName" ) + config.getAsString( "runGroupsOutput", "runGroups.dat" );
+	ofstream f( name.c_str() );
+
+	f << "# group firstRun lastRun nRuns events vzResolution[cm] params" << endl;
+	for ( unsigned int i = 0; i < groups.size(); i++ ){
+		const group &g = groups[ i ];
+		f << i << " " << g.firstRun << " " << g.lastRun << " " << g.nRuns << " " << g.events << " " << g.vzResolution << " "
+			<< g.baseName + config.getAsString( "paramsOutput", "params.dat" ) << endl;
+	}
+	f.close();
+
+	cout << "[runGroups." << __FUNCTION__ << "] " << groups.size() << " groups written to " << name << endl;
+}
@@ -0,0 +1,157 @@
+
+#include "sideStats.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+/**
+ * Knuth's merge exchange network ( TAOCP vol. 3, algorithm 5.2.2M ) for N elements
+ * The pairs do not depend on the data so the sort is branch free
+ */
+static vector< pair< int, int > > mergeExchange( int N ){
+
+	vector< pair< int, int > > pairs;
+	int t = 0;
+	while ( ( 1 << t ) < N )
+		t++;
+
+	for ( int p = 1 << ( t - 1 ); p > 0; p >>= 1 ){
+		int q = 1 << ( t - 1 );
+		int r = 0;
+		int d = p;
+		while ( true ){
+			for ( int i = 0; i < N - d; i++ ){
+				if ( ( i & p ) == r )
+					pairs.push_back( make_pair( i, i + d ) );
+			}
+			if ( q == p )
+				break;
+			d = q - p;
+			q >>= 1;
+			r = p;
+		}
+	}
+	return pairs;
+}
+
+const vector< pair< int, int > > &sideStats::network(){
+	// built once on first use
+	static const vector< pair< int, int > > pairs = mergeExchange( size );
+	return pairs;
+}
+
+void sideStats::set( const double * values, uint32_t inMean, uint32_t inCut ){
+
+	v = values;
+	mMask = inMean;
+	cMask = inCut;
+
+	sum = 0;
+	n = __builtin_popcount( inMean );
+	nSorted = __builtin_popcount( inCut );
+
+	for ( uint32_t m = inMean; m; m &= m - 1 )
+		sum += values[ __builtin_ctz( m ) ];
+
+	// unused tubes are pushed to the end of the network
+	const double inf = numeric_limits<double>::infinity();
+	for ( int i = 0; i < size; i++ )
+		sorted[ i ] = has( inCut, i ) ? values[ i ] : inf;
+
+	const vector< pair< int, int > > &net = network();
+	for ( size_t i = 0; i < net.size(); i++ ){
+		double a = sorted[ net[ i ].first ];
+		double b = sorted[ net[ i ].second ];
+		sorted[ net[ i ].first ] = min( a, b );
+		sorted[ net[ i ].second ] = max( a, b );
+	}
+
+	prefix[ 0 ] = 0;
+	for ( int i = 0; i < nSorted; i++ )
+		prefix[ i + 1 ] = prefix[ i ] + sorted[ i ];
+}
+
+int sideStats::mean( int leaveOut, double &mean ) const {
+
+	double s = sum;
+	int c = n;
+	if ( leaveOut >= 0 && has( mMask, leaveOut ) ){
+		s -= v[ leaveOut ];
+		c--;
+	}
+	mean = s / (double)c;
+	return c;
+}
+
+int sideStats::lowerIndex( double center, double cut ) const {
+	int lo = 0, hi = nSorted;
+	while ( lo < hi ){
+		int mid = ( lo + hi ) / 2;
+		if ( sorted[ mid ] - center > -cut )
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return lo;
+}
+
+int sideStats::upperIndex( double center, double cut ) const {
+	int lo = 0, hi = nSorted;
+	while ( lo < hi ){
+		int mid = ( lo + hi ) / 2;
+		if ( sorted[ mid ] - center < cut )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+int sideStats::cutMean( int leaveOut, double center, double cut, double &mean ) const {
+
+	int lo = lowerIndex( center, cut );
+	int hi = upperIndex( center, cut );
+	double s = 0;
+	int c = 0;
+	if ( hi > lo ){
+		s = prefix[ hi ] - prefix[ lo ];
+		c = hi - lo;
+	}
+
+	if ( leaveOut >= 0 && has( cMask, leaveOut ) ){
+		double t = v[ leaveOut ];
+		if ( t - center < cut && t - center > -cut ){
+			s -= t;
+			c--;
+		}
+	}
+
+	mean = s / (double)c;
+	return c;
+}
+
+int sideStats::median( int leaveOut, double &median ) const {
+
+	// position of the left out tube in the sorted list, any equal value is equivalent
+	int skip = nSorted;
+	int c = nSorted;
+	if ( leaveOut >= 0 && has( cMask, leaveOut ) ){
+		skip = (int)( lower_bound( sorted, sorted + nSorted, v[ leaveOut ] ) - sorted );
+		c--;
+	}
+
+	if ( c <= 0 ){
+		median = numeric_limits<double>::quiet_NaN();
+		return 0;
+	}
+
+	int k = c / 2;
+	double upper = sorted[ k < skip ? k : k + 1 ];
+	if ( c % 2 ){
+		median = upper;
+	} else {
+		double lower = sorted[ k - 1 < skip ? k - 1 : k ];
+		median = 0.5 * ( lower + upper );
+	}
+	return c;
+}
@@ -0,0 +1,316 @@
+
+#include "sliceFitter.h"
+#include <algorithm>
+#include <cmath>
+
+const double sliceFitter::windowSigma = 2.5;
+
+/**
+ * Standard normal pdf and cdf used for the truncation correction
+ */
+static double normalPdf( double x ){
+	return exp( -0.5 * x * x ) / sqrt( 2.0 * TMath::Pi() );
+}
+static double normalCdf( double x ){
+	return 0.5 * erfc( -x / sqrt( 2.0 ) );
+}
+
+/**
+ * Sums the zeroth, first and second moments of the bins with centers in [ lo, hi ]
+ * first and last are the centers of the outermost bins included
+ */
+static double moments( 	const double * centers, const double * counts, int n, double lo, double hi,
+						double &mean, double &variance, double &first, double &last ){
+	double s0 = 0, s1 = 0, s2 = 0;
+	first = hi;
+	last = lo;
+	for ( int i = 0; i < n; i++ ){
+		if ( centers[ i ] < lo || centers[ i ] > hi ) continue;
+		first = min( first, centers[ i ] );
+		last = max( last, centers[ i ] );
+		if ( counts[ i ] <= 0 ) continue;
+		s0 += counts[ i ];
+		s1 += counts[ i ] * centers[ i ];
+		s2 += counts[ i ] * centers[ i ] * centers[ i ];
+	}
+	if ( s0 <= 0 )
+		return 0;
+	mean = s1 / s0;
+	variance = s2 / s0 - mean * mean;
+	if ( variance < 0 )
+		variance = 0;
+	return s0;
+}
+
+int sliceFitter::methodFromString( string name ){
+	transform( name.begin(), name.end(), name.begin(), ::tolower );
+	if ( "truncated" == name )
+		return truncated;
+	if ( "logparabola" == name )
+		return logParabola;
+	return root;
+}
+
+string sliceFitter::methodName( int method ){
+	if ( truncated == method )
+		return "truncated";
+	if ( logParabola == method )
+		return "logParabola";
+	return "root";
+}
+
+/**
+ * Iterated truncated mean and rms. The window is re-centered on each iteration and the
+ * moments are corrected for the part of the gaussian that falls outside of it.
+ * Bin width is removed from the variance with Sheppard's correction.
+ */
+bool sliceFitter::truncatedMean( 	const double * centers, const double * counts, int n, double binWidth,
+									double lo, double hi,
+									double &mean, double &sigma, double &nInWindow ){
+
+	// start at the peak with the rms of the full range
+	int maxBin = -1;
+	for ( int i = 0; i < n; i++ ){
+		if ( centers[ i ] < lo || centers[ i ] > hi ) continue;
+		if ( maxBin < 0 || counts[ i ] > counts[ maxBin ] )
+			maxBin = i;
+	}
+	if ( maxBin < 0 || counts[ maxBin ] <= 0 )
+		return false;
+
+	double m = 0, v = 0, first = 0, last = 0;
+	nInWindow = moments( centers, counts, n, lo, hi, m, v, first, last );
+	if ( nInWindow <= 0 )
+		return false;
+
+	double minSigma = binWidth / sqrt( 12.0 );
+	mean = centers[ maxBin ];
+	sigma = sqrt( v );
+	if ( sigma < minSigma )
+		sigma = minSigma;
+
+	for ( int it = 0; it < maxIterations; it++ ){
+
+		double wLo = max( lo, mean - windowSigma * sigma );
+		double wHi = min( hi, mean + windowSigma * sigma );
+
+		double s0 = moments( centers, counts, n, wLo, wHi, m, v, first, last );
+		if ( s0 <= 0 )
+			return false;
+		nInWindow = s0;
+
+		// truncated normal correction using the current estimate
+		// whole bins are included so the window extends to the outer bin edges
+		double a = ( first - 0.5 * binWidth - mean ) / sigma;
+		double b = ( last + 0.5 * binWidth - mean ) / sigma;
+		double z = normalCdf( b ) - normalCdf( a );
+		if ( z < 1e-6 )
+			return false;
+		double dm = ( normalPdf( a ) - normalPdf( b ) ) / z;
+		double vf = 1.0 + ( a * normalPdf( a ) - b * normalPdf( b ) ) / z - dm * dm;
+		if ( vf <= 0 )
+			return false;
+
+		double nSigma = sqrt( max( v - binWidth * binWidth / 12.0, 0.0 ) / vf );
+		if ( nSigma < minSigma )
+			nSigma = minSigma;
+		double nMean = m - sigma * dm;
+
+		bool converged = 	fabs( nMean - mean ) < 1e-4 * sigma &&
+							fabs( nSigma - sigma ) < 1e-4 * sigma;
+		mean = nMean;
+		sigma = nSigma;
+		if ( converged )
+			break;
+	}
+
+	return true;
+}
+
+/**
+ * Weighted least squares fit of log( counts ) = A + B u + C u^2 in a window around the peak.
+ * The weights are the counts since var( log N ) ~ 1 / N
+ */
+bool sliceFitter::logParabolaFit( 	const double * centers, const double * counts, int n,
+									double lo, double hi,
+									double &mean, double &sigma, double &nInWindow ){
+
+	// mean and sigma are the starting values on entry
+	double wLo = max( lo, mean - 2.0 * sigma );
+	double wHi = min( hi, mean + 2.0 * sigma );
+
+	// normal equation sums in u = x - mean for better conditioning
+	double s[ 5 ] = { 0, 0, 0, 0, 0 };
+	double r[ 3 ] = { 0, 0, 0 };
+	int nPoints = 0;
+	nInWindow = 0;
+	for ( int i = 0; i < n; i++ ){
+		if ( centers[ i ] < wLo || centers[ i ] > wHi || counts[ i ] <= 0 ) continue;
+		double u = centers[ i ] - mean;
+		double w = counts[ i ];
+		double l = log( counts[ i ] );
+		double p = w;
+		for ( int k = 0; k < 5; k++ ){
+			s[ k ] += p;
+			if ( k < 3 )
+				r[ k ] += p * l;
+			p *= u;
+		}
+		nInWindow += counts[ i ];
+		nPoints++;
+	}
+	if ( nPoints < 3 )
+		return false;
+
+	// solve the symmetric 3x3 system by cramer's rule
+	double m00 = s[ 0 ], m01 = s[ 1 ], m02 = s[ 2 ];
+	double m11 = s[ 2 ], m12 = s[ 3 ], m22 = s[ 4 ];
+	double det = 	m00 * ( m11 * m22 - m12 * m12 )
+				-	m01 * ( m01 * m22 - m12 * m02 )
+				+	m02 * ( m01 * m12 - m11 * m02 );
+	if ( fabs( det ) < 1e-300 )
+		return false;
+
+	double detB = 	m00 * ( r[ 1 ] * m22 - m12 * r[ 2 ] )
+				-	r[ 0 ] * ( m01 * m22 - m12 * m02 )
+				+	m02 * ( m01 * r[ 2 ] - r[ 1 ] * m02 );
+	double detC = 	m00 * ( m11 * r[ 2 ] - r[ 1 ] * m12 )
+				-	m01 * ( m01 * r[ 2 ] - r[ 1 ] * m02 )
+				+	r[ 0 ] * ( m01 * m12 - m11 * m02 );
+
+	double B = detB / det;
+	double C = detC / det;
+
+	// must open downwards to be a gaussian
+	if ( C >= 0 )
+		return false;
+
+	mean = mean - B / ( 2.0 * C );
+	sigma = sqrt( -1.0 / ( 2.0 * C ) );
+
+	return true;
+}
+
+bool sliceFitter::estimate( 	int method, const double * centers, const double * counts, int n,
+								double lo, double hi,
+								double &mean, double &meanError, double &sigma, double &sigmaError ){
+
+	if ( root == method || n <= 0 )
+		return false;
+
+	double binWidth = 0;
+	if ( n > 1 )
+		binWidth = ( centers[ n - 1 ] - centers[ 0 ] ) / (double)( n - 1 );
+
+	double nIn = 0;
+	if ( !truncatedMean( centers, counts, n, binWidth, lo, hi, mean, sigma, nIn ) )
+		return false;
+
+	if ( logParabola == method ){
+		double lMean = mean, lSigma = sigma, lN = 0;
+		if ( logParabolaFit( centers, counts, n, lo, hi, lMean, lSigma, lN ) ){
+			// remove the bin width contribution
+			double v = lSigma * lSigma - binWidth * binWidth / 12.0;
+			if ( v > 0 && lMean >= lo && lMean <= hi ){
+				mean = lMean;
+				sigma = sqrt( v );
+				nIn = lN;
+			}
+		}
+		// otherwise fall back on the truncated mean
+	}
+
+	meanError = sigma / sqrt( nIn );
+	sigmaError = sigma / sqrt( 2.0 * nIn );
+
+	return true;
+}
+
+void sliceFitter::fitSlicesY( TH2 * h, int method, double lo, double hi, int cut, string name ){
+
+	if ( !h )
+		return;
+
+	sliceInput in;
+	sliceResult res;
+	snapshot( h, in );
+	estimateSlices( method, in, lo, hi, cut, res );
+	makeHistograms( h, res, name );
+}
+
+void sliceFitter::snapshot( TH2 * h, sliceInput &in ){
+
+	in.nx = h->GetNbinsX();
+	in.ny = h->GetNbinsY();
+	in.centers.resize( in.ny );
+	in.counts.resize( in.nx * in.ny );
+
+	for ( int iy = 0; iy < in.ny; iy++ )
+		in.centers[ iy ] = h->GetYaxis()->GetBinCenter( iy + 1 );
+
+	for ( int ix = 1; ix <= in.nx; ix++ ){
+		for ( int iy = 0; iy < in.ny; iy++ ){
+			in.counts[ ( ix - 1 ) * in.ny + iy ] = h->GetBinContent( ix, iy + 1 );
+		}
+	}
+}
+
+void sliceFitter::estimateSlices( int method, const sliceInput &in, double lo, double hi, int cut, sliceResult &out ){
+
+	out.mean.assign( in.nx, 0 );
+	out.meanError.assign( in.nx, 0 );
+	out.sigma.assign( in.nx, 0 );
+	out.sigmaError.assign( in.nx, 0 );
+	out.valid.assign( in.nx, false );
+
+	if ( 0 == in.ny )
+		return;
+
+	for ( int ix = 0; ix < in.nx; ix++ ){
+
+		const double * counts = &in.counts[ ix * in.ny ];
+		double nEntries = 0;
+		for ( int iy = 0; iy < in.ny; iy++ )
+			nEntries += counts[ iy ];
+		if ( 0 == nEntries || nEntries < cut ) continue;
+
+		out.valid[ ix ] = estimate( method, &in.centers[ 0 ], counts, in.ny, lo, hi,
+									out.mean[ ix ], out.meanError[ ix ], out.sigma[ ix ], out.sigmaError[ ix ] );
+	}
+}
+
+void sliceFitter::makeHistograms( TH2 * h, const sliceResult &res, string name ){
+
+	if ( !h )
+		return;
+	if ( "" == name )
+		name = h->GetName();
+
+	int nx = h->GetNbinsX();
+	TAxis * xAxis = h->GetXaxis();
+	const TArrayD * xBins = xAxis->GetXbins();
+
+	// same output as FitSlicesY, any existing histograms with these names are replaced
+	TH1D * out[ 2 ];
+	string titles[ 2 ] = { "Fitted value of par[1]=Mean", "Fitted value of par[2]=Sigma" };
+	for ( int p = 0; p < 2; p++ ){
+		string pName = name + "_" + ( 0 == p ? "1" : "2" );
+		TObject * old = gDirectory->FindObject( pName.c_str() );
+		if ( old )
+			delete old;
+
+		if ( 0 == xBins->GetSize() )
+			out[ p ] = new TH1D( pName.c_str(), titles[ p ].c_str(), nx, xAxis->GetXmin(), xAxis->GetXmax() );
+		else
+			out[ p ] = new TH1D( pName.c_str(), titles[ p ].c_str(), nx, xBins->GetArray() );
+	}
+
+	for ( int ix = 1; ix <= nx && ix <= (int)res.valid.size(); ix++ ){
+		if ( !res.valid[ ix - 1 ] ) continue;
+
+		out[ 0 ]->SetBinContent( ix, res.mean[ ix - 1 ] );
+		out[ 0 ]->SetBinError( ix, res.meanError[ ix - 1 ] );
+		out[ 1 ]->SetBinContent( ix, res.sigma[ ix - 1 ] );
+		out[ 1 ]->SetBinError( ix, res.sigmaError[ ix - 1 ] );
+	}
+}
@@ -0,0 +1,46 @@
+
+#include "slidingMedian.h"
+
+void slidingMedian::add( double v ){
+	if ( low.empty() || v <= *low.rbegin() )
+		low.insert( v );
+	else
+		high.insert( v );
+	balance();
+}
+
+bool slidingMedian::remove( double v ){
+	if ( !low.empty() && v <= *low.rbegin() ){
+		multiset<double>::iterator it = low.find( v );
+		if ( low.end() == it )
+			return false;
+		low.erase( it );
+	} else {
+		multiset<double>::iterator it = high.find( v );
+		if ( high.end() == it )
+			return false;
+		high.erase( it );
+	}
+	balance();
+	return true;
+}
+
+void slidingMedian::balance(){
+	if ( low.size() > high.size() + 1 ){
+		multiset<double>::iterator it = --low.end();
+		high.insert( *it );
+		low.erase( it );
+	} else if ( high.size() > low.size() ){
+		multiset<double>::iterator it = high.begin();
+		low.insert( *it );
+		high.erase( it );
+	}
+}
+
+double slidingMedian::median() const {
+	if ( low.empty() )
+		return 0;
+	if ( low.size() > high.size() )
+		return *low.rbegin();
+	return 0.5 * ( *low.rbegin() + *high.begin() );
+}
@@ -1,45 +1,139 @@
 
 
 #include "splineMaker.h"
+#include <algorithm>
 
 
 splineMaker::splineMaker( const vector< double > &x, const vector< double > &y, Interpolation::Type type ){
 	spline = NULL;
+	piecewise = false;
 	spline = new Interpolator( x, y, type);
 
 	domainMin = x[ 0 ];
 	domainMax = x[ x.size() - 1 ];
 
+	knots = x;
+	tabulate( type );
+
 }
 
 splineMaker::splineMaker( TH1D* hist, int place, Interpolation::Type type , int firstBin , int lastBin ){
 	spline = NULL;
+	piecewise = false;
 	if ( !hist ) 
 		return;
 
 	int nBins = hist -> GetNbinsX();
+	vector<double> edges( nBins + 1 );
+	vector<double> contents( nBins );
+	for ( int i = 1; i <= nBins; i++ ){
+		edges[ i - 1 ] = hist->GetBinLowEdge( i );
+		contents[ i - 1 ] = hist->GetBinContent( i );
+	}
+	edges[ nBins ] = hist->GetBinLowEdge( nBins ) + hist->GetBinWidth( nBins );
+
+	vector<double> x, y;
+	knotsFromBins( &edges[ 0 ], &contents[ 0 ], nBins, place, x, y, firstBin, lastBin );
+
+	domainMin = x[ 0 ];
+	domainMax = x[ x.size() - 1 ];
+
+	spline = new Interpolator( x, y, type);
+
+	knots = x;
+	tabulate( type );
+}
+
+splineMaker::splineMaker( 	const vector< double > &knots, const vector< double > &c0, const vector< double > &c1,
+							const vector< double > &c2, const vector< double > &c3 ){
+	spline = NULL;
+	this->knots = knots;
+	this->c0 = c0;
+	this->c1 = c1;
+	this->c2 = c2;
+	this->c3 = c3;
+	piecewise = knots.size() >= 2 && c0.size() + 1 == knots.size();
+
+	domainMin = knots.empty() ? 0 : knots[ 0 ];
+	domainMax = knots.empty() ? 0 : knots[ knots.size() - 1 ];
+}
+
+/**
+ * Precomputes the cubic coefficients of every segment from the interpolator itself.
+ * Within a segment the first and second derivatives at two interior points fix the cubic exactly,
+ * so the result is the same curve for the linear, cubic and akima types.
+ * @param type the interpolation type used to build the spline
+ */
+void splineMaker::tabulate( Interpolation::Type type ){
+
+	int nSeg = (int)knots.size() - 1;
+	piecewise = ( Interpolation::kPOLYNOMIAL != type ) && spline && nSeg >= 1;
+	if ( !piecewise )
+		return;
+
+	c0.resize( nSeg );
+	c1.resize( nSeg );
+	c2.resize( nSeg );
+	c3.resize( nSeg );
+
+	for ( int i = 0; i < nSeg; i++ ){
+		double h = knots[ i + 1 ] - knots[ i ];
+		if ( h <= 0 ){
+			c0[ i ] = spline->Eval( knots[ i ] );
+			c1[ i ] = c2[ i ] = c3[ i ] = 0;
+			continue;
+		}
+
+		// interior points, away from the knots where the segment lookup is ambiguous
+		double t1 = 0.25 * h;
+		double t2 = 0.75 * h;
+		double d2a = spline->Deriv2( knots[ i ] + t1 );
+		double d2b = spline->Deriv2( knots[ i ] + t2 );
+
+		// y'' = 2 c2 + 6 c3 t
+		c3[ i ] = ( d2b - d2a ) / ( 6.0 * ( t2 - t1 ) );
+		c2[ i ] = 0.5 * d2a - 3.0 * c3[ i ] * t1;
+		c1[ i ] = spline->Deriv( knots[ i ] + t1 ) - 2.0 * c2[ i ] * t1 - 3.0 * c3[ i ] * t1 * t1;
+		c0[ i ] = spline->Eval( knots[ i ] + t1 ) - t1 * ( c1[ i ] + t1 * ( c2[ i ] + t1 * c3[ i ] ) );
+	}
+}
+
+/**
+ * Index of the segment containing x, x must already be inside the domain
+ */
+int splineMaker::segment( double x ) const {
+	int i = (int)( upper_bound( knots.begin(), knots.end(), x ) - knots.begin() ) - 1;
+	if ( i < 0 )
+		return 0;
+	if ( i > (int)knots.size() - 2 )
+		return (int)knots.size() - 2;
+	return i;
+}
+
+void splineMaker::knotsFromBins( 	const double * edges, const double * contents, int nBins, int place,
+									vector< double > &x, vector< double > &y, int firstBin, int lastBin ){
+
 	int fBin = firstBin;
 	int lBin = lastBin;
-
 	
 	if ( lBin <= -1 || lBin >= nBins )
 		lBin = nBins;
-	if ( fBin < 0 || fBin >= nBins )
+	if ( fBin < 1 || fBin >= nBins )
 		fBin = 1;
 
-	vector<double> x((lBin - fBin) + 1 + 2);
-	vector<double> y((lBin - fBin) + 1 + 2);
+	x.resize((lBin - fBin) + 1 + 2);
+	y.resize((lBin - fBin) + 1 + 2);
 
 
 	int j = 1;
-	x[ 0 ] = hist->GetBinLowEdge( fBin );
-	y[ 0 ] = hist->GetBinContent( fBin );
+	x[ 0 ] = edges[ fBin - 1 ];
+	y[ 0 ] = contents[ fBin - 1 ];
 	for ( int i = fBin; i <= lBin; i++){
 
-		double bEdge = hist->GetBinLowEdge( i );
-		double bWidth = hist->GetBinWidth( i );
+		double bEdge = edges[ i - 1 ];
+		double bWidth = edges[ i ] - edges[ i - 1 ];
 
-		double _y = hist->GetBinContent( i );
+		double _y = contents[ i - 1 ];
 		double _x = bEdge;
 		if ( splineAlignment::left == place )
 			_x = bEdge + .0000001; 		// makes sure there are no troubles with doubles on the edge
@@ -53,14 +147,8 @@ splineMaker::splineMaker( TH1D* hist, int place, Interpolation::Type type , int
 
 		j++;
 	}
-	x[ j ] = hist->GetBinLowEdge( lBin ) + hist->GetBinWidth( lBin );
-	y[ j ] = hist->GetBinContent( lBin );
-
-	domainMin = x[ 0 ];
-	domainMax = x[ x.size() - 1 ];
-
-	spline = new Interpolator( x, y, type);
-
+	x[ j ] = edges[ lBin ];
+	y[ j ] = contents[ lBin - 1 ];
 }
 
 splineMaker::~splineMaker(){
@@ -80,23 +168,22 @@ TGraph * splineMaker::graph( double xmin, double xmax, double step ){
 	if ( xmax > domainMax )
 		xmax = domainMax;
 
-   	const Int_t n = ( (xmax - xmin ) / step)  ;
-   	Int_t i = 0;
-   	Float_t xcoord[n], ycoord[n];
+   	Int_t n = ( (xmax - xmin ) / step)  ;
+   	if ( n < 1 || !ready() )
+   		return new TGraph();
 
-   	for ( double xi = xmin; xi < xmax; xi += step) { 
-      	xcoord[i] = xi;
-      	ycoord[i] = spline->Eval(xi);
-      	i++; 
-   	}
+   	vector< double > xcoord( n ), ycoord( n );
+   	for ( int i = 0; i < n; i++ )
+   		xcoord[ i ] = xmin + step * i;
+   	evalGrid( xmin, step, n, &ycoord[ 0 ] );
    	
-   	TGraph *gr = new TGraph( n, xcoord, ycoord );
+   	TGraph *gr = new TGraph( n, &xcoord[ 0 ], &ycoord[ 0 ] );
 
 	return gr;
 }
 
 
-double splineMaker::eval( double x ){
+double splineMaker::eval( double x ) const {
 
 	double ex = x;
 	if ( ex < domainMin )
@@ -104,8 +191,75 @@ double splineMaker::eval( double x ){
 	else if ( ex > domainMax )
 		ex = domainMax;
 
-	if ( !spline )
+	if ( !ready() )
 		return 0;
 
-	return spline->Eval( ex );
+	if ( !piecewise )
+		return spline->Eval( ex );
+
+	int i = segment( ex );
+	double t = ex - knots[ i ];
+	return c0[ i ] + t * ( c1[ i ] + t * ( c2[ i ] + t * c3[ i ] ) );
+}
+
+void splineMaker::eval( const double * x, double * y, int n ) const {
+
+	if ( !ready() ){
+		for ( int i = 0; i < n; i++ )
+			y[ i ] = 0;
+		return;
+	}
+	if ( !piecewise ){
+		for ( int i = 0; i < n; i++ )
+			y[ i ] = eval( x[ i ] );
+		return;
+	}
+
+	// locate the segments first, then evaluate the polynomials in a branch free loop
+	const int chunk = 256;
+	int seg[ chunk ];
+	double t[ chunk ];
+	const double * p0 = &c0[ 0 ];
+	const double * p1 = &c1[ 0 ];
+	const double * p2 = &c2[ 0 ];
+	const double * p3 = &c3[ 0 ];
+
+	for ( int start = 0; start < n; start += chunk ){
+		int m = min( chunk, n - start );
+		for ( int i = 0; i < m; i++ ){
+			double ex = min( max( x[ start + i ], domainMin ), domainMax );
+			seg[ i ] = segment( ex );
+			t[ i ] = ex - knots[ seg[ i ] ];
+		}
+
+		double * out = y + start;
+		for ( int i = 0; i < m; i++ ){
+			int s = seg[ i ];
+			double ti = t[ i ];
+			out[ i ] = p0[ s ] + ti * ( p1[ s ] + ti * ( p2[ s ] + ti * p3[ s ] ) );
+		}
+	}
+}
+
+void splineMaker::evalGrid( double xmin, double step, int n, double * y ) const {
+
+	if ( !piecewise || step <= 0 ){
+		vector< double > x( n > 0 ? n : 0 );
+		for ( int i = 0; i < n; i++ )
+			x[ i ] = xmin + step * i;
+		if ( n > 0 )
+			eval( &x[ 0 ], y, n );
+		return;
+	}
+
+	// the grid is increasing so the segment only ever moves forward
+	int nSeg = (int)knots.size() - 1;
+	int s = 0;
+	for ( int i = 0; i < n; i++ ){
+		double ex = min( max( xmin + step * i, domainMin ), domainMax );
+		while ( s < nSeg - 1 && ex >= knots[ s + 1 ] )
+			s++;
+		double ti = ex - knots[ s ];
+		y[ i ] = c0[ s ] + ti * ( c1[ s ] + ti * ( c2[ s ] + ti * c3[ s ] ) );
+	}
 }
\ No newline at end of file
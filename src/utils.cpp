@@ -4,6 +4,10 @@
 
 #include <stdio.h>
 #include <unistd.h>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <chrono>
 
 namespace jdbUtils{
 
@@ -17,6 +21,17 @@ namespace jdbUtils{
 		return to_string( (long long unsigned int) u);
 	}
 
+	double wallTime(){
+		return std::chrono::duration<double>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+	}
+
+	uint64_t eventHash( int run, int evt, uint64_t stream ){
+		uint64_t h = ( ( (uint64_t)(uint32_t)run << 32 ) | (uint32_t)evt ) + ( stream + 1 ) * 0x9e3779b97f4a7c15ULL;
+		h = ( h ^ ( h >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+		h = ( h ^ ( h >> 27 ) ) * 0x94d049bb133111ebULL;
+		return h ^ ( h >> 31 );
+	}
+
 	void progressBar( int i, int nevents, int max ){
 		
 		double progress =  ((double)i / (double)nevents);
@@ -56,4 +71,28 @@ namespace jdbUtils{
 		
 	}
 
-}
\ No newline at end of file
+	void parallelFor( int n, int nThreads, std::function<void(int)> f ){
+
+		if ( nThreads > n )
+			nThreads = n;
+
+		if ( nThreads <= 1 ){
+			for ( int i = 0; i < n; i++ )
+				f( i );
+			return;
+		}
+
+		// each worker takes the next index until none are left
+		std::atomic<int> next( 0 );
+		std::vector<std::thread> workers;
+		for ( int t = 0; t < nThreads; t++ ){
+			workers.push_back( std::thread( [&](){
+				for ( int i = next++; i < n; i = next++ )
+					f( i );
+			} ) );
+		}
+		for ( unsigned int t = 0; t < workers.size(); t++ )
+			workers[ t ].join();
+	}
+
+}
@@ -0,0 +1,60 @@
+
+#include "vertexMatcher.h"
+#include <algorithm>
+
+using namespace std;
+
+int vertexMatcher::match( 	const double * west, int nWest, const double * east, int nEast,
+							double tpcZ, double vzCut, bool flip,
+							uint32_t &westMatch, uint32_t &eastMatch ){
+
+	// c * ( w - e ) is computed exactly as c * ( ( -e ) - ( -w ) ), so flipping
+	// is the same as negating both times
+	double sign = flip ? -1 : 1;
+
+	westMatch = 0;
+	eastMatch = 0;
+
+	pair< double, int > w[ size ], e[ size ];
+	for ( int i = 0; i < nWest; i++ )
+		w[ i ] = make_pair( sign * west[ i ], i );
+	for ( int i = 0; i < nEast; i++ )
+		e[ i ] = make_pair( sign * east[ i ], i );
+	sort( w, w + nWest );
+	sort( e, e + nEast );
+
+	// +1 where a window starts and -1 where it ends, the running sum marks matched east tubes
+	int edges[ size + 1 ];
+	for ( int i = 0; i <= nEast; i++ )
+		edges[ i ] = 0;
+
+	int nPairs = 0;
+	int lo = 0, hi = 0;
+	for ( int i = 0; i < nWest; i++ ){
+		double tw = w[ i ].first;
+
+		// tpcZ - vpdZ decreases with the east time
+		while ( lo < nEast && !( tpcZ - constants::c * ( e[ lo ].first - tw ) / 2.0 < vzCut ) )
+			lo++;
+		if ( hi < lo )
+			hi = lo;
+		while ( hi < nEast && tpcZ - constants::c * ( e[ hi ].first - tw ) / 2.0 > -vzCut )
+			hi++;
+
+		if ( hi > lo ){
+			westMatch |= 1u << w[ i ].second;
+			nPairs += hi - lo;
+			edges[ lo ]++;
+			edges[ hi ]--;
+		}
+	}
+
+	int open = 0;
+	for ( int i = 0; i < nEast; i++ ){
+		open += edges[ i ];
+		if ( open > 0 )
+			eastMatch |= 1u << e[ i ].second;
+	}
+
+	return nPairs;
+}
@@ -5,6 +5,11 @@
 #include "histoBook.h"
 #include "chainLoader.h"
 #include "calib.h"
+#include "runGroups.h"
+#include "calibVariants.h"
+#include "autotune.h"
+#include "onlineCalib.h"
+#include "calibDaemon.h"
 #include "utils.h"
 
 
@@ -53,17 +58,92 @@ int main( int argc, char* argv[] ) {
     config.display( "minTOT" );
     config.display( "maxTOT" );
     config.display( "splineType" );
+    config.display( "splineSegments" );
+    config.display( "splineSmoothing" );
+    config.display( "splineCoefficientsOutput" );
+    config.display( "sliceFit" );
+    config.display( "validateSliceFit" );
+    config.display( "resolutionFit" );
+    config.display( "sideReference" );
+    config.display( "pairQAPrescale" );
+    config.display( "inMemory" );
+    config.display( "precision" );
+    config.display( "stopOnConvergence" );
+    config.display( "minIterations" );
+    config.display( "convergeMaxChange" );
+    config.display( "convergeRmsChange" );
+    config.display( "convergeVzChange" );
+    config.display( "solver" );
+    config.display( "directRidge" );
+    config.display( "nThreads" );
     cout << endl;
     config.display( "vzOutlierCut" );    
     cout << endl;
     config.display( "avgNBackgroundCut" );
     config.display( "avgNTimingCut" );
+    config.display( "eventFraction" );
+    config.display( "timeBudget" );
+    config.display( "timeBudgetReserve" );
+    config.display( "variants" );
+    config.display( "tune" );
+    config.display( "tuneMethod" );
+    config.display( "tuneRounds" );
+    config.display( "tuneJobs" );
+    config.display( "tuneVzWeight" );
+    config.display( "tuneOutput" );
+    config.display( "tuneTableOutput" );
+    config.display( "runGroupStarts" );
+    config.display( "minGroupEvents" );
+    config.display( "runGroupsOutput" );
+    config.display( "cacheDir" );
+    config.display( "cacheSketchBins" );
+    config.display( "checkpoint" );
+    config.display( "checkpointOutput" );
+    config.display( "bootstrapReplicas" );
+    config.display( "bootstrapOutput" );
+    config.display( "crossValidationFolds" );
+    config.display( "cvSplineTypes" );
+    config.display( "cvTOTBins" );
+    config.display( "cvWindow" );
+    config.display( "cvFineBins" );
+    config.display( "cvOutput" );
+    config.display( "warmStart" );
+    config.display( "warmStartCutLevel" );
+    config.display( "warmStartIterations" );
+    config.display( "driftWindow" );
+    config.display( "driftWindowRuns" );
+    config.display( "driftMinHits" );
+    config.display( "driftThreshold" );
+    config.display( "driftOutput" );
+    config.display( "driftJumpsOutput" );
+    config.display( "onlineInterval" );
+    config.display( "onlineMinEvents" );
+    config.display( "onlineSettle" );
+    config.display( "onlinePrecisionGain" );
+    config.display( "onlineMaxHours" );
+    config.display( "onlineStopFile" );
+    config.display( "onlineSummaryOutput" );
+    config.display( "daemonSocket" );
+    config.display( "daemonJobs" );
+    config.display( "daemonJob" );
     /* Give a summary of config file */
 
     cout << endl << endl << "Beginning Calibration" << endl << endl;
 
     string jobType = config.getAsString( "jobType", "calibration" );
 
+    // sends this config to a running daemon, the data is already there
+    if ( (string)"submit" == jobType )
+        return calibDaemon::submit( config, argv[ 1 ] );
+
+    // follows dataDir as files are written, the chain grows inside the job
+    if ( (string)"online" == jobType ){
+
+        onlineCalib online( config.getAsInt( "numIterations", 5 ), config );
+        online.run();
+        return 0;
+    }
+
     // Load the files into the chain 
     TChain * chain = new TChain( "tof" );
    
@@ -75,6 +155,44 @@ int main( int argc, char* argv[] ) {
     // get the num of iterations
     int numIterations = config.getAsInt( "numIterations", 5 );
 
+    // several calibrations of the same data with different options
+    if ( (string)"variants" == jobType ){
+
+        calibVariants variants( chain, numIterations, config );
+        variants.calibrate();
+
+        return 0;
+    }
+
+    // search of the cut options on the in memory events
+    if ( (string)"autotune" == jobType ){
+
+        autotune tuner( chain, numIterations, config );
+        tuner.run();
+
+        return 0;
+    }
+
+    // keeps the events in memory and runs the jobs sent to it
+    if ( (string)"daemon" == jobType ){
+
+        calibDaemon daemon( chain, numIterations, config );
+        daemon.serve();
+
+        return 0;
+    }
+
+    // one calibration per group of runs from the same chain
+    if ( (string)"runGroups" == jobType ){
+
+        runGroups groups( chain, config );
+        groups.scan();
+        groups.makeGroups( config.getAsIntVector( "runGroupStarts" ), config.getAsInt( "minGroupEvents", 100000 ) );
+        groups.calibrate( numIterations );
+
+        return 0;
+    }
+
     // create a calibration object
     calib vpdCalib( chain, numIterations, config );
  
@@ -102,6 +220,9 @@ int main( int argc, char* argv[] ) {
         // get the inital offsets
         vpdCalib.offsets();
 
+        // start from an earlier calibration if one is given
+        vpdCalib.warmStart();
+
         // run the main calibration loop
         vpdCalib.loop();
 
@@ -110,6 +231,20 @@ int main( int argc, char* argv[] ) {
         // write out the parameters file
         vpdCalib.writeParameters();
         
+    } else if ( (string)"drift" == jobType ){
+
+        // follow the offsets through the data in run order
+        vpdCalib.trackDrift();
+
+    } else if ( (string)"resume" == jobType ){
+
+        // continue a calibrate job from its last checkpoint
+        if ( !vpdCalib.readCheckpoint() )
+            return 1;
+
+        vpdCalib.loop();
+
+        vpdCalib.writeParameters();
     }
 
 
@@ -87,6 +87,9 @@ bool xmlConfig::getAsBool( char* nName, bool def ) {
 
 string xmlConfig::getAsString( char* nName, string def ) {
 
+	if ( overrides.count( nName ) )
+		return overrides[ nName ];
+
 	if ( !nodeExists( nName ) )
 		return def;
 
@@ -126,6 +129,15 @@ vector<string> xmlConfig::getAsStringVector( char* nName ) {
 
 	std::vector<string> res;
 
+	// a set value is a comma separated list
+	if ( overrides.count( nName ) ){
+		stringstream list( overrides[ nName ] );
+		string item;
+		while ( getline( list, item, ',' ) )
+			res.push_back( item );
+		return res;
+	}
+
 	xml_document<> doc;
 	char* cstr = new char[configFile.size() + 1];  	// Create char buffer to store string copy
   	strcpy (cstr, configFile.c_str());             		// Copy string into char buffer
@@ -207,6 +219,8 @@ void xmlConfig::display( char* nName ){
 
 bool xmlConfig::nodeExists( char* nName ){
 	
+	if ( overrides.count( nName ) )
+		return true;
 
 	xml_document<> doc;
 	char* cstr = new char[configFile.size() + 1];  	// Create char buffer to store string copy
@@ -229,6 +243,9 @@ bool xmlConfig::nodeExists( char* nName ){
 
 bool xmlConfig::isVector( char* nName ){
 
+	if ( overrides.count( nName ) )
+		return overrides[ nName ].find( ',' ) != string::npos;
+
 	if ( nodeExists( nName )){
 		std::vector<string> v = getAsStringVector( nName );
 		if ( v.size() >= 1 && v[ 0 ] != getAsString( nName ) ){
@@ -238,4 +255,98 @@ bool xmlConfig::isVector( char* nName ){
 	} else {
 		return false;
 	}
-}
\ No newline at end of file
+}
+
+void xmlConfig::set( char* nName, string value ){
+	overrides[ nName ] = value;
+}
+
+/*
+*	Position of the node nName under the root node and of the closing tag of the root node
+*	Parameters:
+*		nodeStart, nodeEnd: the node from its opening tag to the end of its closing tag, npos if not found
+*		rootEnd: the closing tag of the root node
+*/
+bool xmlConfig::findNode( const string &xml, const string &nName, size_t &nodeStart, size_t &nodeEnd, size_t &rootEnd ){
+
+	nodeStart = nodeEnd = rootEnd = string::npos;
+	int depth = 0;
+	size_t i = 0;
+	while ( string::npos != ( i = xml.find( '<', i ) ) ){
+
+		// comments, declarations and cdata are not nodes
+		const char * skipTo = NULL;
+		if ( 0 == xml.compare( i, 4, "<!--" ) )
+			skipTo = "-->";
+		else if ( 0 == xml.compare( i, 9, "<![CDATA[" ) )
+			skipTo = "]]>";
+		else if ( i + 1 < xml.size() && ( '?' == xml[ i + 1 ] || '!' == xml[ i + 1 ] ) )
+			skipTo = ">";
+		if ( skipTo ){
+			i = xml.find( skipTo, i );
+			if ( string::npos == i )
+				return false;
+			i += strlen( skipTo );
+			continue;
+		}
+
+		size_t close = xml.find( '>', i );
+		if ( string::npos == close )
+			return false;
+
+		if ( '/' == xml[ i + 1 ] ){
+			depth--;
+			if ( 1 == depth && string::npos != nodeStart && string::npos == nodeEnd )
+				nodeEnd = close + 1;
+			if ( 0 == depth ){
+				rootEnd = i;
+				return true;
+			}
+		} else {
+			size_t nameEnd = xml.find_first_of( " \t\r\n/>", i + 1 );
+			bool empty = '/' == xml[ close - 1 ];
+			if ( 1 == depth && string::npos == nodeStart && nName == xml.substr( i + 1, nameEnd - i - 1 ) ){
+				nodeStart = i;
+				if ( empty )
+					nodeEnd = close + 1;
+			}
+			if ( !empty )
+				depth++;
+		}
+		i = close + 1;
+	}
+	return false;
+}
+
+bool xmlConfig::write( string filename ){
+
+	string out = configFile;
+	for ( map<string, string>::iterator it = overrides.begin(); it != overrides.end(); ++it ){
+
+		// vectors as one <v> node per value
+		string value = it->second;
+		if ( value.find( ',' ) != string::npos ){
+			vector<string> v = getAsStringVector( (char*)it->first.c_str() );
+			value = "";
+			for ( uint i = 0; i < v.size(); i++ )
+				value += "<v>" + v[ i ] + "</v>";
+		}
+
+		string node = "<" + it->first + ">" + value + "</" + it->first + ">";
+		size_t start, end, rootEnd;
+		if ( !findNode( out, it->first, start, end, rootEnd ) )
+			return false;
+		if ( string::npos != end ){
+			out.replace( start, end - start, node );
+		} else {
+			// new nodes go before the closing tag of the root node
+			out.insert( rootEnd, "\t" + node + "\n" );
+		}
+	}
+
+	ofstream f( filename.c_str() );
+	if ( !f.is_open() )
+		return false;
+	f << out;
+	return true;
+}